@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Pack a directory of static files into a C source file for lib/embedded_fs.c.
+
+Every file becomes a const entry (path, mime type, length, body and, with
+--gzip, a precompressed body) so the server can answer it from ROM without
+any filesystem call or heap allocation. The entries are found through a
+perfect hash table: the seed is searched at build time such that no two paths
+share a slot, so a lookup is one hash, one table read and one strcmp.
+
+    python3 embedfs.py static -o lib/embedded_fs_data.c [--gzip]
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+
+# Keep in sync with meme_types in lib/middleware.c.
+MIME_TYPES = {
+    ".css": "text/css",
+    ".gif": "image/gif",
+    ".htm": "text/html",
+    ".html": "text/html",
+    ".jpeg": "image/jpeg",
+    ".jpg": "image/jpeg",
+    ".ico": "image/x-icon",
+    ".js": "application/javascript",
+    ".pdf": "application/pdf",
+    ".mp4": "video/mp4",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+    ".xml": "text/xml",
+}
+DEFAULT_MIME_TYPE = "text/plain"
+
+# A compressed body is only stored when it saves at least this fraction.
+GZIP_MIN_SAVING = 0.1
+
+
+def fnv1a(seed, text):
+    """Must match _Hash() in lib/embedded_fs.c."""
+    h = 2166136261 ^ seed
+    for c in text.encode("utf-8"):
+        h ^= c
+        h = (h * 16777619) & 0xFFFFFFFF
+    # The low bits of FNV are poorly mixed, and only those index the table.
+    h ^= h >> 16
+    h = (h * 0x85EBCA6B) & 0xFFFFFFFF
+    h ^= h >> 13
+    return h
+
+
+def perfect_hash(paths):
+    """Find (seed, table size) such that every path gets its own slot."""
+    size = 1
+    while size < len(paths):
+        size *= 2
+    while True:
+        for seed in range(1, 100000):
+            slots = set(fnv1a(seed, p) & (size - 1) for p in paths)
+            if len(slots) == len(paths):
+                return seed, size
+        size *= 2
+
+
+def c_bytes(name, data):
+    lines = ["static const uint8_t %s[%d] = {" % (name, max(len(data), 1))]
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def collect(root):
+    files = []
+    for folder, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(folder, name)
+            path = "/" + os.path.relpath(full, root).replace(os.sep, "/")
+            files.append((path, full))
+    return sorted(files)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("folder", help="directory with the static files")
+    parser.add_argument("-o", "--output", default="lib/embedded_fs_data.c")
+    parser.add_argument("--gzip", action="store_true", help="also store gzip compressed bodies")
+    args = parser.parse_args()
+
+    files = collect(args.folder)
+    paths = [p for p, _ in files]
+    seed, size = perfect_hash(paths) if paths else (1, 1)
+    slots = [-1] * size
+    for i, p in enumerate(paths):
+        slots[fnv1a(seed, p) & (size - 1)] = i
+
+    out = ["/* Generated by embedfs.py from '%s'. Do not edit. */" % args.folder,
+           '#include "embedded_fs.h"', ""]
+    entries = []
+    for i, (path, full) in enumerate(files):
+        with open(full, "rb") as f:
+            data = f.read()
+        mime = MIME_TYPES.get(os.path.splitext(path)[1], DEFAULT_MIME_TYPE)
+        etag = '"%s"' % hashlib.sha1(data).hexdigest()[:16]
+        mtime = int(os.stat(full).st_mtime)
+        out.append(c_bytes("_file%d" % i, data))
+        gz = "NULL, 0"
+        gz_etag = "NULL"
+        if args.gzip:
+            packed = gzip.compress(data, 9, mtime=0)
+            if len(packed) <= len(data) * (1 - GZIP_MIN_SAVING):
+                out.append(c_bytes("_file%d_gz" % i, packed))
+                gz = "_file%d_gz, %d" % (i, len(packed))
+                # another representation: its own strong entity tag
+                gz_etag = '"%s"' % (etag[:-1] + '-gz"').replace('"', '\\"')
+        entries.append('    { "%s", "%s", _file%d, %d, %s, %d, "%s", %s },'
+                       % (path, mime, i, len(data), gz, mtime, etag.replace('"', '\\"'), gz_etag))
+        out.append("")
+
+    out.append("static const EmbeddedFile _files[] = {")
+    out.extend(entries or ['    { "", "", NULL, 0, NULL, 0, 0, "", NULL },'])
+    out.append("};")
+    out.append("")
+    out.append("static const int16_t _slots[%d] = { %s };" % (size, ", ".join(str(s) for s in slots)))
+    out.append("")
+    out.append("const EmbeddedFS embedded_fs = { _files, %d, _slots, 0x%xu, %du };"
+               % (len(files), size - 1, seed))
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Search the perfect hash for the known header names in lib/http_protocol.c.
+
+The hash is gperf style: the length of the name plus an associated value for
+its first and for its last letter (case-insensitive), modulo the table size.
+The names differ in (length, first, last), so a search over the associated
+values finds one where every name has a slot of its own. Add a name to NAMES
+(and to HTTPHeaderID in lib/server.h, in the same order) and paste the output
+over the tables in lib/http_protocol.c. The lengths let a lookup reject a
+name before it reads the name of the slot.
+
+    python3 headerhash.py
+"""
+
+import random
+
+NAMES = [
+    "accept", "accept-charset", "accept-encoding", "accept-language",
+    "authorization", "cache-control", "connection", "content-disposition",
+    "content-encoding", "content-length", "content-range", "content-type",
+    "cookie", "date", "expect", "forwarded", "host", "if-match",
+    "if-modified-since", "if-none-match", "if-range", "if-unmodified-since",
+    "keep-alive", "origin", "pragma", "range", "referer", "te", "trailer",
+    "transfer-encoding", "upgrade", "user-agent", "x-forwarded-for",
+    "x-requested-with",
+]
+TABLE_SIZE = 64
+
+
+def slot(asso, name):
+    """Must match HTTPHeaderLookup() in lib/http_protocol.c."""
+    return (len(name) + asso[name[0]] + asso[name[-1]]) % TABLE_SIZE
+
+
+def search():
+    letters = sorted(set(n[0] for n in NAMES) | set(n[-1] for n in NAMES))
+    rng = random.Random(1)
+    while True:
+        asso = {c: rng.randrange(TABLE_SIZE) for c in letters}
+        if len(set(slot(asso, n) for n in NAMES)) == len(NAMES):
+            return asso
+
+
+def main():
+    asso = search()
+    table = [0] * TABLE_SIZE
+    for i, name in enumerate(NAMES):
+        table[slot(asso, name)] = i + 1
+    values = [asso.get(chr(ord("a") + i), 0) for i in range(26)]
+    print("static const uint8_t _header_asso[26] = { %s };" % ", ".join(map(str, values)))
+    print("static const uint8_t _header_slots[%d] = { %s };" % (TABLE_SIZE, ", ".join(map(str, table))))
+    lens = [0] + [len(n) for n in NAMES]
+    print("static const uint8_t _header_lens[HTTP_HDR_COUNT] = { %s };" % ", ".join(map(str, lens)))
+
+
+if __name__ == "__main__":
+    main()
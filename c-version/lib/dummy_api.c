@@ -1,8 +1,9 @@
 #include "dummy_api.h"
 #include "multipart.h"
+#include "route_table.h"
 #include <string.h>
 
-const char *c_method_strings[] = { "BAD", "GET", "POST", "PUT", "DELETE" };
+const char *c_method_strings[] = { "BAD", "GET", "POST", "PUT", "DELETE", "HEAD", "CONNECT", "OPTIONS", "TRACE", "PATCH" };
 
 /* Example implementation of API */
 typedef struct {
@@ -31,7 +32,7 @@ void ApiBody(BodyDataBlock_t *block)
             strcpy(body->filename, "Unnamed");
             HTTPHeaderField *f = (HTTPHeaderField *)block->data;
             for(int i=0; i < block->length; i++) {
-                if (strcasecmp(f[i].key, "Content-Disposition") == 0) {
+                if (f[i].id == HTTP_HDR_CONTENT_DISPOSITION) {
                     // extract filename from value string, e.g. 'form-data; name="bestand"; filename="sample.html"'
                     char *sub = strstr(f[i].value, "filename=\"");
                     if (sub) {
@@ -66,14 +67,23 @@ void Api(UrlComponents *c, HTTPReqMessage *req, HTTPRespMessage *res)
 {
     int n, i = 0;
     char *p;
-    char header[] = "HTTP/1.1 200 OK\r\nConnection: close\r\n"
-                    "Content-Type: text/html; charset=UTF-8\r\n\r\n"
-                    "<!DOCTYPE html><html><body>\n";
+    char header[160];
+    const char header_fmt[] = "HTTP/1.1 200 OK\r\nConnection: %s\r\n"
+                    "Content-Type: text/html; charset=UTF-8\r\n";
+    const char *opening = "\r\n<!DOCTYPE html><html><body>\n";
 
-    /* Build header. */
+    /* Build header. A request with a body appends to the response while the body
+       is absorbed, so only a request without one knows its Content-Length up front. */
+    if (req->bodyType == eNoBody) {
+        res->KeepAlive = req->KeepAlive;
+    }
     p = (char *)res->_buf;
-    n = strlen(header);
-    memcpy(p, header, n);
+    n = sprintf(p, header_fmt, HTTPConnectionValue(res));
+    p += n;
+    i += n;
+    int header_end = i;
+    n = strlen(opening);
+    memcpy(p, opening, n);
     p += n;
     i += n;
 
@@ -94,7 +104,7 @@ void Api(UrlComponents *c, HTTPReqMessage *req, HTTPRespMessage *res)
     p += n;
 
     for (int j = 0; j < c->parameters_len; j++) {
-        sprintf(comp, "<li>%s: <tt>%s</tt></li>", c->parameters[j].name, c->parameters[j].value);
+        sprintf(comp, "<li>%s: <tt>%s</tt></li>", c->parameters[j].name, url_parameter_value(c, j));
         n = strlen(comp);
         memcpy(p, comp, n);
         i += n;
@@ -118,6 +128,49 @@ void Api(UrlComponents *c, HTTPReqMessage *req, HTTPRespMessage *res)
         memcpy(p, tail, n);
         i += n;
         p += n;
+
+        // Insert the Content-Length now that the size of the body is known.
+        int body_len = i - header_end - 2; // the body starts after the empty line
+        n = sprintf(header, "Content-Length: %d\r\n", body_len);
+        memmove(res->_buf + header_end + n, res->_buf + header_end, i - header_end);
+        memcpy(res->_buf + header_end, header, n);
+        i += n;
         res->_index = i;
     }
 }
+
+/* Every v1 url, for any method, ends up in Api(). */
+/* The API urls: /v1/route[/path][:command][?querystring], split like
+   parse_url() does: the command is all that follows the first ':', and an
+   empty command is "none". */
+static const char *_api_routes[] = {
+    "/v1/{route}",
+    "/v1/{route}:",
+    "/v1/{route}:{command*}",
+    "/v1/{route}/",
+    "/v1/{route}/:",
+    "/v1/{route}/:{command*}",
+    "/v1/{route}/{path*}",
+    "/v1/{route}/{path*}:",
+    "/v1/{route}/{path*}:{command*}",
+    NULL
+};
+
+static void _ApiRoute(RouteMatch *match, HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    UrlComponents *c = &(match->url);
+    const char *path = RouteTableParam(match, "path");
+    const char *command = RouteTableParam(match, "command");
+
+    c->apiversion = (const char *)match->context;
+    c->route = RouteTableParam(match, "route");
+    c->path = path ? path : "";
+    c->command = command ? command : "none";
+    Api(c, req, res);
+}
+
+void ApiInit(void)
+{
+    for (int i = 0; _api_routes[i]; i++)
+        RouteTableAdd(HTTP_UNKNOWN, _api_routes[i], &_ApiRoute, (void *)"v1");
+}
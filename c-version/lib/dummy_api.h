@@ -4,6 +4,16 @@
 #include "server.h"
 #include "url.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void Api(UrlComponents *c, HTTPReqMessage *req, HTTPRespMessage *res);
 
+// Register the API in the route table.
+void ApiInit(void);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
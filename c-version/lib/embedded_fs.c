@@ -0,0 +1,32 @@
+#include "embedded_fs.h"
+#include <string.h>
+
+/* FNV-1a, seeded, with a final mix of the high bits into the low ones that
+   index the table. Must match fnv1a() in embedfs.py. */
+static uint32_t _Hash(uint32_t seed, const char *s)
+{
+    uint32_t h = 2166136261u ^ seed;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+const EmbeddedFile *EmbeddedFSLookup(const char *path)
+{
+    const EmbeddedFS *fs = &embedded_fs;
+    int i;
+
+    if (fs->file_count == 0)
+        return NULL;
+    /* The seed was chosen so that every embedded path has a slot of its own,
+       so one comparison tells whether the path is there. */
+    i = fs->slots[_Hash(fs->seed, path) & fs->slot_mask];
+    if ((i < 0) || strcmp(fs->files[i].path, path))
+        return NULL;
+    return fs->files + i;
+}
@@ -0,0 +1,50 @@
+#ifndef __MICRO_HTTP_EMBEDDED_FS_H__
+#define __MICRO_HTTP_EMBEDDED_FS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Static files compiled into the binary. embedfs.py packs a directory into
+   lib/embedded_fs_data.c; _ReadStaticFiles then answers those paths from ROM,
+   without filesystem calls or heap. Enable with -DHTTP_EMBEDDED_FS=1. */
+#ifndef HTTP_EMBEDDED_FS
+#define HTTP_EMBEDDED_FS 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _EmbeddedFile
+{
+    const char *path;           // URI path, e.g. "/index.html"
+    const char *mime_type;
+    const uint8_t *data;
+    uint32_t length;
+    const uint8_t *gzip_data;   // precompressed body, NULL when not stored
+    uint32_t gzip_length;
+    uint32_t mtime;             // modification time of the source file
+    const char *etag;           // quoted strong entity tag (content hash)
+    const char *gzip_etag;      // entity tag of the gzip body, NULL when not stored
+} EmbeddedFile;
+
+typedef struct _EmbeddedFS
+{
+    const EmbeddedFile *files;
+    uint16_t file_count;
+    const int16_t *slots;       // perfect hash table: index in files, or -1
+    uint32_t slot_mask;
+    uint32_t seed;
+} EmbeddedFS;
+
+// Defined in the generated lib/embedded_fs_data.c
+extern const EmbeddedFS embedded_fs;
+
+// Find a file by its URI path. Returns NULL when it is not embedded.
+const EmbeddedFile *EmbeddedFSLookup(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
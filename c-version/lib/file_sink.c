@@ -0,0 +1,269 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // mkostemp, O_DIRECT
+#endif
+#include "file_sink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+struct _FileSink
+{
+    FILE_SINK_REPORT_CB report;
+    void *context;
+    uint8_t *buf;        // HTTP_UPLOAD_BUFFER bytes, aligned
+    size_t fill;         // bytes in buf
+    off_t offset;        // bytes written to the file
+    int fd;              // -1: no file open (e.g. a form field without a file)
+    int error;
+    struct timespec start;
+    char name[128];
+    char raw_name[128];
+    char folder[256];
+    char temp[256 + 128 + 8];
+};
+
+static uint32_t _Usec(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+/* Take the file name from a Content-Disposition value, without any folder:
+   'form-data; name="f"; filename="a.bin"'. Returns -1 for a part that is not
+   a file, or a name that cannot be stored. */
+static int _FileName(const char *value, char *name, size_t size)
+{
+    const char *p = strstr(value, "filename=");
+    const char *end;
+    size_t len;
+
+    if (!p)
+        return -1;
+    p += 9;
+    if (*p == '"') {
+        end = strchr(++p, '"');
+    } else {
+        end = p + strcspn(p, "; \t");
+    }
+    if (!end)
+        return -1;
+    for (const char *q = p; q < end; q++) {
+        if ((*q == '/') || (*q == '\\'))
+            p = q + 1; // some clients send a path
+    }
+    len = end - p;
+    if ((len == 0) || (len >= size) || (p[0] == '.'))
+        return -1; // also rejects "." and ".."
+    for (size_t i = 0; i < len; i++) {
+        if ((uint8_t)p[i] < 0x20)
+            return -1;
+    }
+    memcpy(name, p, len);
+    name[len] = 0;
+    return 0;
+}
+
+static void _Open(FileSink_t *sink, const char *name)
+{
+    snprintf(sink->name, sizeof(sink->name), "%s", name);
+    snprintf(sink->temp, sizeof(sink->temp), "%s/.%s.XXXXXX", sink->folder, sink->name);
+#if HTTP_UPLOAD_O_DIRECT
+    sink->fd = mkostemp(sink->temp, O_DIRECT);
+#else
+    sink->fd = mkstemp(sink->temp);
+#endif
+    sink->error = (sink->fd < 0) ? errno : 0;
+    if (sink->fd >= 0)
+        fchmod(sink->fd, 0644);
+    sink->fill = 0;
+    sink->offset = 0;
+    clock_gettime(CLOCK_MONOTONIC, &(sink->start));
+}
+
+/* Write all of iov at the current file offset. */
+static void _WriteAll(FileSink_t *sink, struct iovec *iov, int count)
+{
+    while ((count > 0) && (iov[count - 1].iov_len == 0))
+        count--;
+    while ((count > 0) && !sink->error) {
+        ssize_t n = pwritev(sink->fd, iov, count, sink->offset);
+        if (n < 0) {
+            if (errno != EINTR)
+                sink->error = errno;
+            continue;
+        }
+        if (n == 0) {
+            sink->error = EIO;
+            break;
+        }
+        sink->offset += n;
+        while ((count > 0) && ((size_t)n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void _Flush(FileSink_t *sink)
+{
+    struct iovec iov = { sink->buf, sink->fill };
+
+    _WriteAll(sink, &iov, 1);
+    sink->fill = 0;
+}
+
+static void _Write(FileSink_t *sink, const char *p, size_t n)
+{
+    if ((sink->fd < 0) || sink->error)
+        return;
+#if !HTTP_UPLOAD_O_DIRECT
+    if (n >= HTTP_UPLOAD_BUFFER) {
+        // a large block goes out directly, behind what is buffered
+        struct iovec iov[2] = { { sink->buf, sink->fill }, { (void *)p, n } };
+        _WriteAll(sink, iov, 2);
+        sink->fill = 0;
+        return;
+    }
+#endif
+    while (n > 0) {
+        size_t c = HTTP_UPLOAD_BUFFER - sink->fill;
+        if (c > n)
+            c = n;
+        memcpy(sink->buf + sink->fill, p, c);
+        sink->fill += c;
+        p += c;
+        n -= c;
+        if (sink->fill == HTTP_UPLOAD_BUFFER)
+            _Flush(sink);
+    }
+}
+
+/* Finish the current file: write what is buffered, move the file into place
+   and report it. Also reports a file that could not be created. */
+static void _Close(FileSink_t *sink)
+{
+    FileSinkResult result;
+    char path[sizeof(sink->folder) + sizeof(sink->name) + 1];
+
+    if ((sink->fd < 0) && !sink->error)
+        return; // no file in this part
+    if (sink->fd >= 0) {
+#if HTTP_UPLOAD_O_DIRECT
+        /* O_DIRECT writes whole aligned blocks: pad the tail, then cut the file
+           back to its size. */
+        off_t size = sink->offset + sink->fill;
+        size_t tail = (sink->fill + HTTP_UPLOAD_ALIGN - 1) & ~(size_t)(HTTP_UPLOAD_ALIGN - 1);
+        memset(sink->buf + sink->fill, 0, tail - sink->fill);
+        sink->fill = tail;
+        _Flush(sink);
+        if (!sink->error && (ftruncate(sink->fd, size) < 0))
+            sink->error = errno;
+        sink->offset = size;
+#else
+        _Flush(sink);
+#endif
+#if HTTP_UPLOAD_FSYNC
+        if (!sink->error && (fsync(sink->fd) < 0))
+            sink->error = errno;
+#endif
+        if ((close(sink->fd) < 0) && !sink->error)
+            sink->error = errno;
+        sink->fd = -1;
+        snprintf(path, sizeof(path), "%s/%s", sink->folder, sink->name);
+        if (!sink->error && (rename(sink->temp, path) < 0))
+            sink->error = errno;
+        if (sink->error)
+            unlink(sink->temp);
+    }
+
+    if (sink->report) {
+        result.name = sink->name;
+        result.size = (size_t)sink->offset;
+        result.usec = _Usec(&(sink->start));
+        result.error = sink->error;
+        sink->report(sink->context, &result);
+    }
+    sink->error = 0;
+}
+
+static void _Discard(FileSink_t *sink)
+{
+    if (sink->fd >= 0) {
+        close(sink->fd);
+        unlink(sink->temp);
+        sink->fd = -1;
+    }
+}
+
+FileSink_t *FileSinkCreate(const char *folder, const char *raw_name, FILE_SINK_REPORT_CB report, void *context)
+{
+    FileSink_t *sink = (FileSink_t *)malloc(sizeof(FileSink_t));
+    void *buf = NULL;
+
+    if (!sink)
+        return NULL;
+    if (posix_memalign(&buf, HTTP_UPLOAD_ALIGN, HTTP_UPLOAD_BUFFER) != 0) {
+        free(sink);
+        return NULL;
+    }
+    memset(sink, 0, sizeof(FileSink_t));
+    sink->buf = (uint8_t *)buf;
+    sink->fd = -1;
+    sink->report = report;
+    sink->context = context;
+    snprintf(sink->folder, sizeof(sink->folder), "%s", folder);
+    snprintf(sink->raw_name, sizeof(sink->raw_name), "%s", raw_name ? raw_name : "upload.bin");
+    return sink;
+}
+
+void file_sink_block(BodyDataBlock_t *block)
+{
+    FileSink_t *sink = (FileSink_t *)block->context;
+    HTTPHeaderField *f;
+    char name[sizeof(sink->name)];
+
+    switch(block->type) {
+        case eStart:
+            break;
+        case eDataStart:
+            _Open(sink, sink->raw_name);
+            if (sink->fd < 0)
+                _Close(sink); // report the failure; the data is ditched
+            break;
+        case eSubHeader:
+            f = (HTTPHeaderField *)block->data;
+            for (int i = 0; i < block->length; i++) {
+                if ((f[i].id == HTTP_HDR_CONTENT_DISPOSITION) && (_FileName(f[i].value, name, sizeof(name)) == 0)) {
+                    _Open(sink, name);
+                    if (sink->fd < 0)
+                        _Close(sink); // report the failure; the data is ditched
+                    break;
+                }
+            }
+            break;
+        case eDataBlock:
+            _Write(sink, block->data, block->length);
+            break;
+        case eDataEnd:
+            _Close(sink);
+            break;
+        case eTerminate:
+        case eAbort:
+            _Discard(sink); // a part that did not end is incomplete
+            free(sink->buf);
+            free(sink);
+            break;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __MICRO_HTTP_FILE_SINK_H__
+#define __MICRO_HTTP_FILE_SINK_H__
+
+#include "multipart.h"
+
+/* Upload sink: a BODY_DATABLOCK_CB that stores every file part of a multipart
+   body (or a whole raw body) as a file in a folder. A part is written to a
+   temporary file next to its destination and renamed into place when it is
+   complete, so a file is never seen half written and an aborted upload leaves
+   nothing behind. Data is gathered in an aligned buffer and written in large
+   batches; a block that is larger than the buffer is written together with the
+   buffered bytes in one pwritev() instead of being copied. POSIX only. */
+
+// Bytes gathered before a write. A multiple of HTTP_UPLOAD_ALIGN.
+#ifndef HTTP_UPLOAD_BUFFER
+#define HTTP_UPLOAD_BUFFER (64 * 1024)
+#endif
+// Alignment of the buffer, and of the file offsets and sizes with O_DIRECT.
+#ifndef HTTP_UPLOAD_ALIGN
+#define HTTP_UPLOAD_ALIGN 4096
+#endif
+// Write around the page cache (Linux O_DIRECT); for large uploads to flash.
+#ifndef HTTP_UPLOAD_O_DIRECT
+#define HTTP_UPLOAD_O_DIRECT 0
+#endif
+// fsync() each file before it is renamed into place.
+#ifndef HTTP_UPLOAD_FSYNC
+#define HTTP_UPLOAD_FSYNC 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;  // file name in the folder
+    size_t size;       // bytes stored
+    uint32_t usec;     // from the part header until the file was in place
+    int error;         // 0, or the errno of the operation that failed
+} FileSinkResult;
+
+// Called for every file after it is stored (or failed).
+typedef void (*FILE_SINK_REPORT_CB)(void *context, const FileSinkResult *result);
+
+typedef struct _FileSink FileSink_t;
+
+// Create a sink that stores uploads in folder. A raw (not multipart) body is
+// stored as raw_name. Pass file_sink_block and the sink to setup_multipart();
+// the sink frees itself after eTerminate or eAbort.
+FileSink_t *FileSinkCreate(const char *folder, const char *raw_name, FILE_SINK_REPORT_CB report, void *context);
+void file_sink_block(BodyDataBlock_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
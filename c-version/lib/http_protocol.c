@@ -1,29 +1,56 @@
 #include "server.h"
 #include <string.h>
-
-HTTPMethod HaveMethod(char *method)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Method tokens are case-sensitive. The length selects the candidates, so a
+   method is classified with at most two fixed-size compares, which compilers
+   turn into one or two integer comparisons. */
+HTTPMethod HaveMethod(const char *method, size_t len)
 {
-    HTTPMethod m;
-
-    if (memcmp(method, "GET", 3) == 0)
-        m = HTTP_GET;
-    else if (memcmp(method, "POST", 4) == 0)
-        m = HTTP_POST;
-    else if (memcmp(method, "PUT", 3) == 0)
-        m = HTTP_PUT;
-    else if (memcmp(method, "DELETE", 6) == 0)
-        m = HTTP_DELETE;
-    else
-        m = HTTP_GET;
-
-    return m;
+    switch (len) {
+        case 3:
+            if (!memcmp(method, "GET", 3))
+                return HTTP_GET;
+            if (!memcmp(method, "PUT", 3))
+                return HTTP_PUT;
+            break;
+        case 4:
+            if (!memcmp(method, "POST", 4))
+                return HTTP_POST;
+            if (!memcmp(method, "HEAD", 4))
+                return HTTP_HEAD;
+            break;
+        case 5:
+            if (!memcmp(method, "PATCH", 5))
+                return HTTP_PATCH;
+            if (!memcmp(method, "TRACE", 5))
+                return HTTP_TRACE;
+            break;
+        case 6:
+            if (!memcmp(method, "DELETE", 6))
+                return HTTP_DELETE;
+            break;
+        case 7:
+            if (!memcmp(method, "OPTIONS", 7))
+                return HTTP_OPTIONS;
+            if (!memcmp(method, "CONNECT", 7))
+                return HTTP_CONNECT;
+            break;
+    }
+    return HTTP_UNKNOWN;
 }
 
 void InitReqHeader(HTTPReqHeader *hdr)
 {
     hdr->_buffer_valid = 0;
+    hdr->_scanned = 0;
     hdr->Method = HTTP_UNKNOWN;
     hdr->FieldCount = 0;
+    memset(hdr->Known, 0, sizeof(hdr->Known));
     hdr->URI = "";
     hdr->Response = "";
     hdr->RawCopy = NULL;
@@ -33,6 +60,9 @@ void InitReqHeader(HTTPReqHeader *hdr)
 
 void InitReqMessage(HTTPReqMessage *req)
 {
+    req->usedAsResponseFromServer = 0;
+    req->KeepAlive = 0;
+    req->_requests = 0;
     req->protocol_state = eReq_Header;
     req->ContentType = "";
     req->BodyCB = NULL;
@@ -41,21 +71,121 @@ void InitReqMessage(HTTPReqMessage *req)
     req->bodyType = eNoBody;
     req->bodySize = 0;
     req->userContext = NULL;
+    req->_multipart = NULL;
     InitReqHeader(&(req->Header));
 }
 
+void ResetReqMessage(HTTPReqMessage *req)
+{
+    int requests = req->_requests;
+    void *multipart = req->_multipart;
+    // Bytes received after the end of the previous request belong to the next
+    // (pipelined) request. Keep them, moved to the start of the buffer.
+    int leftover = req->_valid - req->_used;
+    if ((leftover > 0) && (req->_used > 0)) {
+        memmove(req->_buf, req->_buf + req->_used, leftover);
+    }
+    InitReqMessage(req);
+    req->_requests = requests;
+    req->_multipart = multipart;
+    req->_valid = (leftover > 0) ? leftover : 0;
+}
+
+void ReleaseReqMessage(HTTPReqMessage *req)
+{
+    free(req->_multipart);
+    req->_multipart = NULL;
+}
+
 void InitRespMessage(HTTPRespMessage *resp)
 {
     resp->BodyCB = NULL;
+    resp->BodyData = NULL;
+    resp->BodyDataLength = 0;
+    resp->BodyRelease = NULL;
+#if HTTP_USE_SENDFILE
+    resp->BodyFd = -1;
+    resp->BodyOffset = 0;
+    resp->BodyLength = 0;
+#endif
+    resp->KeepAlive = 0;
+    resp->Header.FieldCount = 0;
     resp->_index = 0;
+    resp->_segment_count = 0;
+    resp->_segment_sent = 0;
+}
+
+int HTTPRespAppend(HTTPRespMessage *resp, const void *data, size_t length)
+{
+    HTTPRespSegment *last;
+
+    if (length == 0)
+        return 0;
+    if (resp->_segment_count > 0) {
+        last = resp->_segments + resp->_segment_count - 1;
+        if (last->data + last->length == (const uint8_t *)data) {
+            last->length += length;
+            return 0;
+        }
+    }
+    if (resp->_segment_count >= HTTP_RESP_SEGMENTS)
+        return -1;
+    resp->_segments[resp->_segment_count].data = (const uint8_t *)data;
+    resp->_segments[resp->_segment_count].length = length;
+    resp->_segment_count++;
+    return 0;
+}
+
+const char *HTTPScanLF(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf32));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i lf16 = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf16));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    /* Portable: test eight bytes at once for a zero byte after XOR with LF. */
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= 0x0a0a0a0a0a0a0a0aull;
+        if ((w - 0x0101010101010101ull) & ~w & 0x8080808080808080ull)
+            break; // the LF is in these eight bytes
+        p += 8;
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == '\n')
+            return p;
+    }
+    return NULL;
 }
 
 char *GetLineFromBuffer(HTTPReqMessage *req)
 {
-    req->_buf[req->_valid] = '\0'; // allowed!
     char *p = (char *)req->_buf + req->_used;
-    char *pfound = strstr(p, "\r\n");
-    if (pfound) {
+    const char *end = (const char *)req->_buf + req->_valid;
+    const char *lf = p;
+
+    // a line ends at CRLF; a bare LF is part of the line
+    while (((lf = HTTPScanLF(lf, end)) != NULL) && ((lf == p) || (lf[-1] != '\r')))
+        lf++;
+    if (lf) {
+        char *pfound = (char *)lf - 1;
         *pfound = '\0';
         int len = (int)(pfound - p);
         req->_used += len + 2;
@@ -75,53 +205,156 @@ char *GetLineFromBuffer(HTTPReqMessage *req)
     return NULL;
 }
 
-int _IsLengthHeader(const char *key)
+/* Perfect hash over the names of HTTPHeaderID, generated by headerhash.py:
+   the slot of a name is its length plus the associated values of its first
+   and last letter, and holds the only ID that can have that name. The length
+   is compared first, so a longer name never reads past the one of its slot. */
+static const char *const _header_names[HTTP_HDR_COUNT] = {
+    "", "accept", "accept-charset", "accept-encoding", "accept-language",
+    "authorization", "cache-control", "connection", "content-disposition",
+    "content-encoding", "content-length", "content-range", "content-type",
+    "cookie", "date", "expect", "forwarded", "host", "if-match",
+    "if-modified-since", "if-none-match", "if-range", "if-unmodified-since",
+    "keep-alive", "origin", "pragma", "range", "referer", "te", "trailer",
+    "transfer-encoding", "upgrade", "user-agent", "x-forwarded-for",
+    "x-requested-with",
+};
+static const uint8_t _header_asso[26] = { 10, 0, 17, 17, 63, 21, 31, 47, 14, 0, 54, 22, 0, 43, 61, 21, 0, 34, 0, 57, 30, 0, 0, 4, 0, 0 };
+static const uint8_t _header_slots[64] = { 9, 0, 5, 34, 0, 18, 7, 0, 0, 1, 20, 27, 0, 0, 10, 8, 0, 2, 0, 0, 14, 21, 13, 0, 4, 0, 0, 0, 12, 11, 19, 0, 22, 32, 29, 0, 31, 25, 26, 0, 0, 30, 0, 0, 17, 0, 24, 16, 0, 0, 0, 0, 6, 33, 0, 0, 3, 0, 28, 0, 0, 0, 15, 23 };
+static const uint8_t _header_lens[HTTP_HDR_COUNT] = { 0, 6, 14, 15, 15, 13, 13, 10, 19, 16, 14, 13, 12, 6, 4, 6, 9, 4, 8, 17, 13, 8, 19, 10, 6, 6, 5, 7, 2, 7, 17, 7, 10, 15, 16 };
+
+static unsigned int _HeaderAsso(char c)
 {
-    return !strcasecmp(key, "content-length");
+    c |= 0x20; // lower case
+    return ((c >= 'a') && (c <= 'z')) ? _header_asso[c - 'a'] : 0;
 }
 
-int _IsTypeField(const char *key)
+HTTPHeaderID HTTPHeaderLookup(const char *name, size_t len)
 {
-    return !strcasecmp(key, "content-type");
+    HTTPHeaderID id;
+
+    if (len == 0)
+        return HTTP_HDR_UNKNOWN;
+    id = (HTTPHeaderID)_header_slots[(len + _HeaderAsso(name[0]) + _HeaderAsso(name[len - 1])) & 63];
+    if ((id == HTTP_HDR_UNKNOWN) || (len != _header_lens[id]) || strncasecmp(name, _header_names[id], len))
+        return HTTP_HDR_UNKNOWN;
+    return id;
 }
 
-int _IsTransferEncoding(const char *key)
+const char *GetReqHeader(HTTPReqMessage *req, const char *key)
 {
-    return !strcasecmp(key, "transfer-encoding");
+    unsigned int i;
+    HTTPHeaderID id = HTTPHeaderLookup(key, strlen(key));
+
+    if (id != HTTP_HDR_UNKNOWN)
+        return req->Header.Known[id];
+    for (i = 0; i < req->Header.FieldCount; i++) {
+        if (!strcasecmp(req->Header.Fields[i].key, key)) {
+            return req->Header.Fields[i].value;
+        }
+    }
+    return NULL;
 }
 
-void _ParseHeader(HTTPReqMessage *req)
+static const char *_wkday[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *_month[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+int HTTPFormatDate(char *buf, time_t t)
 {
-    char *lines[32];
-    int line = 0;
-    char *p = (char *)req->Header._buffer;
+    struct tm tm;
 
-    // DebugMsg("\tParse Header\n");
+    // Not strftime(): the day and month names must not depend on the locale.
+    gmtime_r(&t, &tm);
+    return sprintf(buf, "%s, %02d %s %04d %02d:%02d:%02d GMT", _wkday[tm.tm_wday], tm.tm_mday,
+        _month[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
 
-    // First split the header buffer into lines by searching for the \r\n sequences
-    // The method used here is to separate on \r and skip the following \n.
-    for(line = 0; line < 32; line++) {
-        lines[line] = strsep(&p, "\r");
-        if (!p) {
-            break;
-        }
-        p++; // skip the \n
-        if (! *(lines[line])) {
-            break;
-        }
+/* Days since 1970-01-01 of a proleptic Gregorian date (timegm() is not portable). */
+static long _DaysFromCivil(int y, int m, int d)
+{
+    y -= (m <= 2);
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+time_t HTTPParseDate(const char *s)
+{
+    char mon[4];
+    int d, y, hh, mm, ss, m;
+
+    /* IMF-fixdate, then the obsolete RFC 850 and asctime() forms (RFC 9110, 5.6.7). */
+    if ((sscanf(s, "%*[a-zA-Z], %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6) &&
+        (sscanf(s, "%*[a-zA-Z], %d-%3s-%d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6) &&
+        (sscanf(s, "%*s %3s %d %d:%d:%d %d", mon, &d, &hh, &mm, &ss, &y) != 6)) {
+        return (time_t)-1;
     }
+    for (m = 0; (m < 12) && strcmp(mon, _month[m]); m++)
+        ;
+    if (m == 12)
+        return (time_t)-1;
+    if (y < 100)
+        y += (y < 70) ? 2000 : 1900;
+    return (time_t)(_DaysFromCivil(y, m + 1, d) * 86400L + hh * 3600L + mm * 60L + ss);
+}
+
+// Case-insensitive match of a whole token in a comma separated header value.
+static int _HasToken(const char *value, const char *token)
+{
+    size_t n = strlen(token);
+    const char *p = value;
+
+    while (*p) {
+        const char *end;
+        while ((*p == ' ') || (*p == '\t') || (*p == ','))
+            p++;
+        end = p + strcspn(p, ",");
+        while ((end > p) && ((end[-1] == ' ') || (end[-1] == '\t')))
+            end--;
+        if (((size_t)(end - p) == n) && !strncasecmp(p, token, n))
+            return 1;
+        p += strcspn(p, ",");
+    }
+    return 0;
+}
+
+/* End of the header line that starts at p: the LF of the first CRLF (a bare
+   LF is part of the line, as in GetLineFromBuffer), or NULL. */
+static char *_LineEnd(char *p, char *end)
+{
+    const char *lf = p;
+
+    while (((lf = HTTPScanLF(lf, end)) != NULL) && ((lf == p) || (lf[-1] != '\r')))
+        lf++;
+    return (char *)lf;
+}
+
+/* Parse the complete header in [p, end) in place, in a single pass: the line
+   ends, the ':' and the spaces that end the tokens are overwritten with NULs,
+   and URI, Version and Fields point into the header itself. The fields the
+   protocol needs are recognized while they are split. */
+void _ParseHeader(HTTPReqMessage *req, char *p, char *end)
+{
+    const char **known = req->Header.Known;
+    char *lf = _LineEnd(p, end);
+    char *cur;
 
-    // Step 2: Get the verb, path and HTTP identifier from the first line
-    // Split by space
+    // Step 1: Get the verb, path and HTTP identifier from the first line
     // VERB path HTTP/1.1
     req->Header.URI = "";
     req->Header.Response = "";
     req->Header.Version = NULL;
     req->Header.Method = HTTP_UNKNOWN;
-    char *cur = lines[0];
+    if (!lf)
+        lf = end - 1; // cannot happen: the header ends with an empty line
+    lf[-1] = '\0';
+    cur = p;
     char *verb = strsep(&cur, " ");
     if (!req->usedAsResponseFromServer) {
-        req->Header.Method = HaveMethod(verb);
+        req->Header.Method = HaveMethod(verb, strlen(verb));
         if (cur) {
             req->Header.URI = strsep(&cur, " ");
             req->Header.Version = cur; // can also be NULL
@@ -131,32 +364,40 @@ void _ParseHeader(HTTPReqMessage *req)
         // verb now holds the response code and explanation
         req->Header.Response = cur;
     }
-    // Step 3: Split the remaining lines into fields.
-    // All subsequent lines are in the form of KEY ": " VALUE, although the space is not mandatory by spec.
-    // so leading spaces need to be trimmed, and the separator is simply ':'
+
+    // Step 2: Split the remaining lines into fields, up to the empty line.
+    // All subsequent lines are in the form of KEY ":" OWS VALUE OWS. Fields
+    // beyond MAX_HEADER_FIELDS are not stored, but known ones are still
+    // recorded in Known[].
     req->Header.FieldCount = 0;
-    for(line = 1; line < 32; line++) {
-        if (! *(lines[line])) {
+    memset(known, 0, sizeof(req->Header.Known));
+    for (p = lf + 1; (p < end) && ((lf = _LineEnd(p, end)) != NULL); p = lf + 1) {
+        char *eol = lf - 1;
+        char *colon, *value;
+        if (eol == p)
+            break; // empty line: end of the header
+        *eol = '\0';
+        colon = (char *)memchr(p, ':', eol - p);
+        if (!colon)
             break;
-        }
-        if (req->Header.FieldCount >= MAX_HEADER_FIELDS) {
-            break; // Fields[] is fixed-size; ignore any further header lines
-        }
-        p = lines[line];
-        req->Header.Fields[req->Header.FieldCount].key = strsep(&p, ":");
-        if (p) {
-            while(*p == ' ') {
-                p++;
-            }
-            req->Header.Fields[req->Header.FieldCount].value = p;
-            // printf("'%s' -> '%s'\n", req->Header.Fields[req->Header.FieldCount].key, req->Header.Fields[req->Header.FieldCount].value);
+        *colon = '\0';
+        value = colon + 1;
+        while ((*value == ' ') || (*value == '\t'))
+            value++;
+        while ((eol > value) && ((eol[-1] == ' ') || (eol[-1] == '\t')))
+            *--eol = '\0';
+        HTTPHeaderID id = HTTPHeaderLookup(p, colon - p);
+        if ((id != HTTP_HDR_UNKNOWN) && !known[id])
+            known[id] = value; // the first occurrence counts
+        if (req->Header.FieldCount < MAX_HEADER_FIELDS) {
+            req->Header.Fields[req->Header.FieldCount].key = p;
+            req->Header.Fields[req->Header.FieldCount].value = value;
+            req->Header.Fields[req->Header.FieldCount].id = id;
             req->Header.FieldCount++;
-        } else {
-            break;
         }
     }
 
-    // Step 4: Determine how much body data is required for this request
+    // Step 3: Determine how much body data is required for this request
     // If the Transfer-Encoding is set to 'chunked', the body size is set to a high
     // value, such that we know that there is body data coming, and for the time
     // being it is not yet complete.
@@ -165,49 +406,57 @@ void _ParseHeader(HTTPReqMessage *req)
     req->bodySize = 0;
     req->ContentType = NULL;
 
-    if ((req->Header.Method == HTTP_POST) || (req->usedAsResponseFromServer)) {
-        int length_header_seen = 0;
-        for (unsigned int i = 0; i < req->Header.FieldCount; i++) {
-            if (_IsLengthHeader(req->Header.Fields[i].key)) {
-                long len = strtol(req->Header.Fields[i].value, NULL, 0);
-                length_header_seen = 1;
-                // Only a positive Content-Length means there is a body. A negative
-                // value would become a huge size_t (and a negative (int) length in
-                // the body callback -> OOB copy); a zero length is simply no body.
-                // In both cases leave bodyType as eNoBody so the request is never
-                // driven into body processing: a 0-length body callback is treated
-                // as stream termination and can double-free the body absorber.
-                if (len > 0) {
-                    req->bodyType = eTotalSize;
-                    req->bodySize = (size_t)len;
-                }
-                break;
+    // Any request may carry a body, framed by Content-Length or Transfer-Encoding;
+    // ignoring the framing would read the body as the next request.
+    if (known[HTTP_HDR_CONTENT_LENGTH] || known[HTTP_HDR_TRANSFER_ENCODING] ||
+        (req->Header.Method == HTTP_POST) || (req->usedAsResponseFromServer)) {
+        if (known[HTTP_HDR_CONTENT_LENGTH]) {
+            long len = strtol(known[HTTP_HDR_CONTENT_LENGTH], NULL, 0);
+            // Only a positive Content-Length means there is a body. A negative
+            // value would become a huge size_t (and a negative (int) length in
+            // the body callback -> OOB copy); a zero length is simply no body.
+            // In both cases leave bodyType as eNoBody so the request is never
+            // driven into body processing: a 0-length body callback is treated
+            // as stream termination and can double-free the body absorber.
+            if (len > 0) {
+                req->bodyType = eTotalSize;
+                req->bodySize = (size_t)len;
             }
         }
-        for (unsigned int i = 0; i < req->Header.FieldCount; i++) {
-            if (_IsTypeField(req->Header.Fields[i].key)) {
-                req->ContentType = req->Header.Fields[i].value;
-                break;
-            }
-        }
-        for (unsigned int i = 0; i < req->Header.FieldCount; i++) {
-            if (_IsTransferEncoding(req->Header.Fields[i].key)) {
-                if (strstr(req->Header.Fields[i].value, "chunked") != NULL) {
-                    req->bodyType = eChunked;
-                    req->chunkState = eChunkHeader;
-                } else {
-                    printf("Unknown Encoding: %s\n", req->Header.Fields[i].value);
-                }
-                break;
+        req->ContentType = known[HTTP_HDR_CONTENT_TYPE];
+        if (known[HTTP_HDR_TRANSFER_ENCODING]) {
+            if (strstr(known[HTTP_HDR_TRANSFER_ENCODING], "chunked") != NULL) {
+                req->bodyType = eChunked;
+                req->chunkState = eChunkHeader;
+            } else {
+                printf("Unknown Encoding: %s\n", known[HTTP_HDR_TRANSFER_ENCODING]);
             }
         }
         // Fall back to "read the body until the peer disconnects" only when the
         // client gave no explicit framing at all. An explicit non-positive
         // Content-Length means "no body", so it must not become eUntilDisconnect.
-        if ((req->bodyType == eNoBody) && !length_header_seen) {
+        // Only a POST (or a response) without any framing is read until then.
+        if ((req->bodyType == eNoBody) && !known[HTTP_HDR_CONTENT_LENGTH] &&
+            ((req->Header.Method == HTTP_POST) || (req->usedAsResponseFromServer))) {
             req->bodyType = eUntilDisconnect;
         }
     }
+    // Step 4: Decide whether the connection may persist after this request.
+    // HTTP/1.1 is persistent unless the client says "close", HTTP/1.0 only when
+    // it asks for "keep-alive". A body that is delimited by the disconnect of
+    // the client can never be followed by another request.
+    req->KeepAlive = (req->Header.Version != NULL) && !strcmp(req->Header.Version, "HTTP/1.1");
+    if (known[HTTP_HDR_CONNECTION]) {
+        if (_HasToken(known[HTTP_HDR_CONNECTION], "close")) {
+            req->KeepAlive = 0;
+        } else if (_HasToken(known[HTTP_HDR_CONNECTION], "keep-alive")) {
+            req->KeepAlive = 1;
+        }
+    }
+    if ((req->bodyType == eUntilDisconnect) || (req->_requests >= HTTP_MAX_KEEPALIVE_REQUESTS)) {
+        req->KeepAlive = 0;
+    }
+
     req->BodyCB = NULL; // to be filled in by the application
     req->BodyContext = NULL; // to be filled in by the application
 }
@@ -220,8 +469,14 @@ int _HandleChunked(HTTPReqMessage *req)
             if (chunkline) {
                 long remain = strtol(chunkline, NULL, 16);
                 // DebugMsg("Chunkline read: '%s'; size = %d\n", chunkline, (int)remain);
-                if (remain <= 0) {
-                    return 0; // done, or reject a negative/invalid chunk size
+                if (remain < 0) {
+                    // reject a negative/invalid chunk size; what follows cannot be trusted
+                    req->KeepAlive = 0;
+                    return 0;
+                }
+                if (remain == 0) {
+                    req->chunkState = eChunkFinal; // last chunk; trailer fields follow
+                    continue;
                 }
                 req->chunkRemain = (size_t)remain;
                 req->chunkState = eChunkBody;
@@ -263,6 +518,18 @@ int _HandleChunked(HTTPReqMessage *req)
                 return 1; // need more data
             }
         }
+
+        // Consume the (ignored) trailer fields up to the empty line that ends the
+        // body, so that a pipelined request that follows starts at its first byte.
+        if (req->chunkState == eChunkFinal) {
+            char *chunkline = GetLineFromBuffer(req);
+            if (!chunkline) {
+                return 1; // need more data
+            }
+            if (*chunkline == '\0') {
+                return 0; // done
+            }
+        }
     }
 }
 
@@ -301,15 +568,65 @@ int _GetBody(HTTPReqMessage *req)
     return 0;
 }
 
-int _TestHeaderComplete(HTTPReqHeader *hdr)
+/* Offset just past the empty line that ends the header in buf, or -1. The
+   search resumes where the previous call stopped (*scanned), so a header that
+   arrives in many small pieces is scanned once in total. */
+int _FindHeaderEnd(const char *buf, int length, int *scanned)
 {
-    char *pfound = strstr(hdr->_buffer, "\r\n\r\n");
-    if (pfound != NULL) {
-        return 4 + (int)(pfound - hdr->_buffer);
+    const char *p = buf + *scanned;
+    const char *end = buf + length;
+
+    while ((p = HTTPScanLF(p, end)) != NULL) {
+        if ((p - buf >= 3) && !memcmp(p - 3, "\r\n\r", 3)) {
+            return 1 + (int)(p - buf);
+        }
+        p++;
     }
+    *scanned = length;
     return -1;
 }
 
+void _HeaderDone(HTTPReqMessage *req, char *header, int until)
+{
+    HTTPReqHeader *hdr = &(req->Header);
+
+    // Application requires a raw copy of the header
+    if (hdr->RawCopy) {
+        hdr->RawCopyLength = (until <= hdr->RawCopySize) ? until : hdr->RawCopySize;
+        memcpy(hdr->RawCopy, header, hdr->RawCopyLength);
+    }
+    req->_requests++;
+    _ParseHeader(req, header, header + until);
+    req->protocol_state = eReq_HeaderDone;
+}
+
+static void _Rebase(const char **ptr, const char *from, int length, const char *to)
+{
+    if (*ptr && (*ptr >= from) && (*ptr < from + length))
+        *ptr = to + (*ptr - from);
+}
+
+/* The body is received into the same buffer as the header, so a header that
+   was parsed in place has to move out of the way before the body arrives. */
+void _RelocateHeader(HTTPReqMessage *req, char *header, int until)
+{
+    HTTPReqHeader *hdr = &(req->Header);
+
+    memcpy(hdr->_buffer, header, until);
+    _Rebase(&(hdr->URI), header, until, hdr->_buffer);
+    _Rebase(&(hdr->Version), header, until, hdr->_buffer);
+    _Rebase(&(hdr->Response), header, until, hdr->_buffer);
+    _Rebase(&(req->ContentType), header, until, hdr->_buffer);
+    for (unsigned int i = 0; i < hdr->FieldCount; i++) {
+        _Rebase(&(hdr->Fields[i].key), header, until, hdr->_buffer);
+        _Rebase(&(hdr->Fields[i].value), header, until, hdr->_buffer);
+    }
+    for (int i = 0; i < HTTP_HDR_COUNT; i++) {
+        _Rebase(&(hdr->Known[i]), header, until, hdr->_buffer);
+    }
+    hdr->_buffer_valid = until;
+}
+
 int _GetHeader(HTTPReqMessage *req)
 {
     char *p = (char *)req->_buf;
@@ -317,44 +634,55 @@ int _GetHeader(HTTPReqMessage *req)
     p += req->_used;
     HTTPReqHeader *hdr = &(req->Header);
 
-    int valid = hdr->_buffer_valid;
-    int space = HTTP_MAX_HEADER_SIZE - valid;
-    int cancopy = (n > space) ? space : n;
-
     if (n == 0) {
         req->protocol_state = eReq_HeaderTooBig;
         return 0;
     }
 
-    //printf("Copying %d bytes to offset %d\n", cancopy, valid);
-    memcpy(hdr->_buffer + valid, p, cancopy);
-    hdr->_buffer_valid += cancopy; // new valid!
-    // make it a null terminated string, so we know until where data was read later on, without
-    // checking 'n' in every string operation. This is allowed, because we allocated 4 bytes more in the buffer
-    hdr->_buffer[hdr->_buffer_valid] = '\0';
-
     int new_bytes_used;
-    int until = _TestHeaderComplete(&req->Header);
-    if (until >= 0) {
-        
-        // Application requires a raw copy of the header
-        if (hdr->RawCopy) {
-            hdr->RawCopyLength = (until <= hdr->RawCopySize) ? until : hdr->RawCopySize;
-            memcpy(hdr->RawCopy, hdr->_buffer, hdr->RawCopyLength);
+    int until;
+    if (hdr->_buffer_valid == 0) {
+        // Zero-copy: while the header fits in the receive buffer, it is parsed
+        // where it was received.
+        until = _FindHeaderEnd(p, n, &(hdr->_scanned));
+        if (until >= 0) {
+            _HeaderDone(req, p, until);
+            if (req->bodyType != eNoBody) {
+                _RelocateHeader(req, p, until);
+            }
+            new_bytes_used = until;
+        } else if (req->_valid < HTTP_BUFFER_SIZE) {
+            DebugMsg("Header not yet found.\n");
+            return 0; // the next bytes are received behind these
+        } else {
+            // The receive buffer is full: collect the header in Header._buffer.
+            memcpy(hdr->_buffer, p, n);
+            hdr->_buffer_valid = n;
+            new_bytes_used = n;
         }
-
-        _ParseHeader(req); // Do we actually NEED to parse everything??
-        new_bytes_used = until - valid; // old valid!
-        req->protocol_state = eReq_HeaderDone;
     } else {
-        DebugMsg("Header not yet found.\n");
-        new_bytes_used = cancopy; // bytes from input used, but not yet reached full header
+        int valid = hdr->_buffer_valid;
+        int space = HTTP_MAX_HEADER_SIZE - valid;
+        int cancopy = (n > space) ? space : n;
+
+        //printf("Copying %d bytes to offset %d\n", cancopy, valid);
+        memcpy(hdr->_buffer + valid, p, cancopy);
+        hdr->_buffer_valid += cancopy; // new valid!
+
+        until = _FindHeaderEnd(hdr->_buffer, hdr->_buffer_valid, &(hdr->_scanned));
+        if (until >= 0) {
+            _HeaderDone(req, hdr->_buffer, until);
+            new_bytes_used = until - valid; // old valid!
+        } else {
+            DebugMsg("Header not yet found.\n");
+            new_bytes_used = cancopy; // bytes from input used, but not yet reached full header
+        }
     }
-    if (new_bytes_used >= req->_valid) {
+    // Bytes after the header (body, or a pipelined request) stay in the buffer.
+    req->_used += new_bytes_used;
+    if (req->_used >= req->_valid) {
         req->_valid = 0;
         req->_used = 0;
-    } else {
-        req->_used = new_bytes_used;
     }
     //printf("%d bytes used. Leaving %d bytes to process later.\n", new_bytes_used, req->_valid - req->_used);
 
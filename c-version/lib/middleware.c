@@ -4,9 +4,18 @@
 #include <sys/stat.h>
 #endif
 #include "middleware.h"
-#include "url.h"
+#include "route_table.h"
 #include "multipart.h"
-#include "dummy_api.h"
+#if ENABLE_STATIC_FILE && HTTP_USE_SENDFILE
+#include <fcntl.h>
+#endif
+#if ENABLE_STATIC_FILE == 1
+#include "static_cache.h"
+#endif
+#include "embedded_fs.h"
+#ifdef HTTP_UPLOAD_FOLDER
+#include "file_sink.h"
+#endif
 
 /* Known Mime Types */
 typedef struct {
@@ -55,13 +64,593 @@ static const char *get_mime_type(const char *filename)
 #if ENABLE_STATIC_FILE 
 int filestream_out(void *context, uint8_t *buf, int len)
 {
-    int result = fread(buf, 1, len, (FILE *)context);
-    if (!result) {
-        fclose((FILE *)context);
+    return fread(buf, 1, len, (FILE *)context);
+}
+
+/* BodyRelease of filestream_out: also when the body is not sent to the end. */
+static void _FileStreamClose(void *context)
+{
+    fclose((FILE *)context);
+}
+
+#if (ENABLE_STATIC_FILE == 1) || HTTP_EMBEDDED_FS
+/* Returns whether a q-value ("0", "0.0", "1", "0.5", ...) is zero. */
+static int _IsZeroQValue(const char *q)
+{
+    if (*q++ != '0')
+        return 0;
+    if (*q == '.') {
+        q++;
+        while (*q == '0')
+            q++;
+    }
+    return (*q == '\0') || (*q == ',') || (*q == ';') || (*q == ' ') || (*q == '\t');
+}
+
+/* Returns whether an Accept-Encoding value allows 'coding': it is listed, or
+   covered by "*", without "q=0" (RFC 9110, 12.5.3). */
+static int _AcceptsEncoding(const char *accept, const char *coding)
+{
+    size_t len = strlen(coding);
+    int wildcard = 0;
+    const char *p = accept;
+
+    while (*p) {
+        while ((*p == ' ') || (*p == '\t') || (*p == ','))
+            p++;
+        const char *token = p;
+        while (*p && (*p != ',') && (*p != ';') && (*p != ' ') && (*p != '\t'))
+            p++;
+        size_t token_len = (size_t)(p - token);
+        int zero = 0;
+        while (*p && (*p != ',')) {
+            if (((*p == 'q') || (*p == 'Q')) && (p[1] == '=') && ((p[-1] == ';') || (p[-1] == ' '))) {
+                zero = _IsZeroQValue(p + 2);
+            }
+            p++;
+        }
+        if ((token_len == len) && !strncasecmp(token, coding, len))
+            return !zero;
+        if ((token_len == 1) && (*token == '*'))
+            wildcard = !zero;
+    }
+    return wildcard;
+}
+#endif
+
+#if ENABLE_STATIC_FILE == 1
+/* Precompressed siblings of a static file ("app.js.br", "app.js.gz"), in order of preference. */
+static const char *const precompressed_codings[] = { "br", "gzip", NULL };
+static const char *const precompressed_suffixes[] = { ".br", ".gz", NULL };
+
+/* The file is one of the precompressed siblings of another. */
+static int _IsPrecompressed(const char *path)
+{
+    size_t n = strlen(path);
+    int i;
+
+    for (i = 0; precompressed_suffixes[i]; i++) {
+        size_t k = strlen(precompressed_suffixes[i]);
+        if ((n > k) && !strcmp(path + n - k, precompressed_suffixes[i]))
+            return 1;
+    }
+    return 0;
+}
+
+/* Of the precompressed siblings in the bitmask 'siblings' (see
+   StaticFileSiblings()), pick the first whose coding the client accepts:
+   append its suffix to 'path' and return the coding. */
+static const char *_SelectPrecompressed(HTTPReqMessage *req, char *path, size_t size, unsigned siblings)
+{
+    const char *accept = GetReqHeaderById(req, HTTP_HDR_ACCEPT_ENCODING);
+    size_t n = strlen(path);
+    int i;
+
+    if (!accept)
+        return NULL;
+    for (i = 0; precompressed_codings[i]; i++) {
+        if ((siblings & (1u << i)) && (n + strlen(precompressed_suffixes[i]) < size) &&
+            _AcceptsEncoding(accept, precompressed_codings[i])) {
+            strcpy(path + n, precompressed_suffixes[i]);
+            return precompressed_codings[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+/* A static file, whatever it is served from (ROM, the RAM cache or disk). */
+typedef struct {
+    const char *mime_type;
+    long length;
+    time_t mtime;              // 0 when unknown
+    const char *etag;          // NULL when unknown
+    const char *encoding;      // Content-Encoding of the body, NULL for identity
+    int vary;                  // the file has other encodings
+    const char *header;        // prebuilt Content-Type .. ETag lines, or NULL
+    size_t header_length;
+    const uint8_t *data;       // body in memory, or
+    HTTPBODY_RELEASE_CALLBACK release;
+    void *release_context;
+    int fd;                    // body to sendfile(), or
+    FILE *fp;                  // body to stream with filestream_out
+} StaticFile;
+
+/* Give up the body of a static file that is not sent (HEAD). */
+static void _DropStaticBody(StaticFile *f)
+{
+    if (f->release)
+        f->release(f->release_context);
+#if HTTP_USE_SENDFILE
+    if (f->fd >= 0)
+        close(f->fd);
+#endif
+    if (f->fp)
+        fclose(f->fp);
+}
+
+/* Returns whether an If-None-Match value is "*" or lists the entity tag. The
+   comparison is weak (RFC 9110, 13.1.2): a W/ prefix is ignored on both sides. */
+static int _ETagListMatch(const char *list, const char *etag)
+{
+    const char *p = list;
+    size_t len;
+
+    if ((etag[0] == 'W') && (etag[1] == '/'))
+        etag += 2;
+    len = strlen(etag);
+    while (*p) {
+        while ((*p == ' ') || (*p == '\t') || (*p == ','))
+            p++;
+        if (*p == '*')
+            return 1;
+        if ((p[0] == 'W') && (p[1] == '/'))
+            p += 2;
+        const char *tag = p;
+        if (*p == '"') {
+            p++;
+            while (*p && (*p != '"'))
+                p++;
+            if (*p)
+                p++;
+        }
+        if (((size_t)(p - tag) == len) && !memcmp(tag, etag, len))
+            return 1;
+        while (*p && (*p != ','))
+            p++;
+    }
+    return 0;
+}
+
+/* Returns whether the client's copy of the file is still current, so that a
+   header-only 304 can be sent. If-None-Match takes precedence over
+   If-Modified-Since (RFC 9110, 13.2.2). */
+static int _NotModified(HTTPReqMessage *req, const StaticFile *f)
+{
+    const char *value;
+
+    if ((req->Header.Method != HTTP_GET) && (req->Header.Method != HTTP_HEAD))
+        return 0;
+    if ((value = GetReqHeaderById(req, HTTP_HDR_IF_NONE_MATCH)) != NULL)
+        return f->etag && _ETagListMatch(value, f->etag);
+    if (((value = GetReqHeaderById(req, HTTP_HDR_IF_MODIFIED_SINCE)) != NULL) && f->mtime) {
+        time_t since = HTTPParseDate(value);
+        return (since != (time_t)-1) && (f->mtime <= since);
+    }
+    return 0;
+}
+
+/* Validator fields shared by 200, 206 and 304 responses. */
+static char *_StaticValidators(char *p, const StaticFile *f)
+{
+    if (f->mtime) {
+        p += sprintf(p, "Last-Modified: ");
+        p += HTTPFormatDate(p, f->mtime);
+        p += sprintf(p, "\r\n");
+    }
+    if (f->etag)
+        p += sprintf(p, "ETag: %s\r\n", f->etag);
+    return p;
+}
+
+/* Tell caches that the response depends on Accept-Encoding, when the file
+   has precompressed siblings. Shared by the 200/206 and the 304 answers. */
+static char *_StaticVary(char *p, const StaticFile *f)
+{
+    if (f->vary)
+        p += sprintf(p, "Vary: Accept-Encoding\r\n");
+    return p;
+}
+
+static char *_StaticCoding(char *p, const StaticFile *f)
+{
+    if (f->encoding)
+        p += sprintf(p, "Content-Encoding: %s\r\n", f->encoding);
+    return _StaticVary(p, f);
+}
+
+/* Answer a conditional request whose validators match: the header fields
+   that a 200 would have carried to update the client's cache, and no body. */
+static void _SendNotModified(HTTPReqMessage *req, HTTPRespMessage *res, StaticFile *f)
+{
+    char *p = (char *)res->_buf;
+
+    res->KeepAlive = req->KeepAlive;
+    p += sprintf(p, "HTTP/1.1 304 Not Modified\r\nConnection: %s\r\n", HTTPConnectionValue(res));
+    p = _StaticValidators(p, f);
+    p = _StaticVary(p, f);
+    p += sprintf(p, "\r\n");
+    res->_index = p - (char *)res->_buf;
+    _DropStaticBody(f);
+}
+
+/* One satisfiable byte range, first and last byte included. */
+typedef struct {
+    long start;
+    long end;
+} ByteRange;
+
+/* Parse a Range header against a body of 'length' bytes (RFC 9110, 14.2).
+   Returns the number of satisfiable ranges, 0 when none is satisfiable, or
+   -1 when the header must be ignored: not "bytes", malformed, or more than
+   'max' ranges (a client asking for many tiny ranges only costs us). */
+static int _ParseRange(const char *value, long length, ByteRange *ranges, int max)
+{
+    const char *p = value;
+    char *q;
+    int count = 0, seen = 0;
+
+    if (strncasecmp(p, "bytes=", 6))
+        return -1;
+    p += 6;
+    while (*p) {
+        long start, end;
+        while ((*p == ' ') || (*p == '\t') || (*p == ','))
+            p++;
+        if (!*p)
+            break;
+        if (*p == '-') {
+            /* Suffix range: the last N bytes. */
+            long suffix = strtol(p + 1, &q, 10);
+            if ((q == p + 1) || (suffix < 0))
+                return -1;
+            start = (suffix < length) ? length - suffix : 0;
+            end = (suffix > 0) ? length - 1 : -1;
+        } else {
+            start = strtol(p, &q, 10);
+            if ((q == p) || (*q != '-') || (start < 0))
+                return -1;
+            p = q + 1;
+            end = length - 1;
+            if ((*p >= '0') && (*p <= '9')) {
+                end = strtol(p, &q, 10);
+                if (end < start)
+                    return -1;
+                if (end >= length)
+                    end = length - 1;
+            } else {
+                q = (char *)p;
+            }
+        }
+        p = q;
+        while ((*p == ' ') || (*p == '\t'))
+            p++;
+        if (*p && (*p != ','))
+            return -1;
+        if (++seen > max)
+            return -1;
+        if ((start < length) && (start <= end)) {
+            ranges[count].start = start;
+            ranges[count].end = end;
+            count++;
+        }
     }
-    return result;
+    return seen ? count : -1;
 }
 
+/* If-Range: the range only applies to the representation the client has
+   part of. An entity tag must match strongly, a date exactly. */
+static int _IfRangeMatches(HTTPReqMessage *req, const StaticFile *f)
+{
+    const char *value = GetReqHeaderById(req, HTTP_HDR_IF_RANGE);
+
+    if (!value)
+        return 1;
+    if (value[0] == '"')
+        return f->etag && !strcmp(value, f->etag);
+    if ((value[0] == 'W') && (value[1] == '/'))
+        return 0;
+    return f->mtime && (HTTPParseDate(value) == f->mtime);
+}
+
+/* Copy body bytes [pos, pos + len) of a static file into buf. */
+static int _ReadStaticBody(StaticFile *f, long pos, uint8_t *buf, int len)
+{
+    if (f->data) {
+        memcpy(buf, f->data + pos, len);
+        return len;
+    }
+#if HTTP_USE_SENDFILE
+    if (f->fd >= 0) {
+        ssize_t n = pread(f->fd, buf, len, pos);
+        return (n > 0) ? (int)n : 0;
+    }
+#endif
+    if (f->fp && (fseek(f->fp, pos, SEEK_SET) == 0))
+        return fread(buf, 1, len, f->fp);
+    return 0;
+}
+
+/* State of a range response that is generated into _buf by _RangesOut: a
+   multipart/byteranges body, or a single range of a FILE stream. */
+typedef struct {
+    StaticFile file;
+    int multipart;
+    char boundary[24];
+    int count;
+    int index;          // range being sent
+    long pos;           // next body byte of that range
+    char text[200];     // part header or closing boundary being sent
+    int text_length;
+    int text_pos;
+    ByteRange ranges[HTTP_MAX_RANGES];
+} StaticRanges;
+
+/* Part header before range i, or the closing boundary when i == count. */
+static int _RangePartHeader(StaticRanges *r, int i, char *buf, size_t size)
+{
+    const char *crlf = (i > 0) ? "\r\n" : "";
+
+    if (i == r->count)
+        return snprintf(buf, size, "\r\n--%s--\r\n", r->boundary);
+    return snprintf(buf, size, "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+        crlf, r->boundary, r->file.mime_type, r->ranges[i].start, r->ranges[i].end, r->file.length);
+}
+
+static int _RangesOut(void *context, uint8_t *buf, int len)
+{
+    StaticRanges *r = (StaticRanges *)context;
+    int n = 0;
+
+    while (n < len) {
+        if (r->text_pos < r->text_length) {
+            int c = r->text_length - r->text_pos;
+            if (c > len - n)
+                c = len - n;
+            memcpy(buf + n, r->text + r->text_pos, c);
+            r->text_pos += c;
+            n += c;
+        } else if ((r->index < r->count) && (r->pos <= r->ranges[r->index].end)) {
+            long c = r->ranges[r->index].end - r->pos + 1;
+            if (c > len - n)
+                c = len - n;
+            int got = _ReadStaticBody(&(r->file), r->pos, buf + n, (int)c);
+            if (got <= 0)
+                break; // the file shrank; the connection closes short of Content-Length
+            r->pos += got;
+            n += got;
+        } else if (r->multipart && (r->index < r->count)) {
+            r->index++;
+            if (r->index < r->count)
+                r->pos = r->ranges[r->index].start;
+            r->text_length = _RangePartHeader(r, r->index, r->text, sizeof(r->text));
+            r->text_pos = 0;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+static void _RangesRelease(void *context)
+{
+    StaticRanges *r = (StaticRanges *)context;
+
+    _DropStaticBody(&(r->file));
+    free(r);
+}
+
+/* Answer a Range request: 206 with one range (sent zero-copy where the file
+   allows it) or several (multipart/byteranges), or 416 when no range fits. */
+static void _SendStaticRanges(HTTPReqMessage *req, HTTPRespMessage *res, StaticFile *f,
+    ByteRange *ranges, int count)
+{
+    char *p = (char *)res->_buf;
+    StaticRanges *r = NULL;
+    long length;
+    int i;
+
+    res->KeepAlive = req->KeepAlive;
+    if (count == 0) {
+        p += sprintf(p, "HTTP/1.1 416 Range Not Satisfiable\r\nConnection: %s\r\n"
+            "Content-Range: bytes */%ld\r\nContent-Length: 0\r\n\r\n", HTTPConnectionValue(res), f->length);
+        res->_index = p - (char *)res->_buf;
+        _DropStaticBody(f);
+        return;
+    }
+    if ((count > 1) || (!f->data && (f->fd < 0))) {
+        r = (StaticRanges *)malloc(sizeof(StaticRanges));
+        if (!r) {
+            _DropStaticBody(f);
+            res->KeepAlive = 0;
+            res->_index = sprintf((char *)res->_buf, "HTTP/1.1 503 Service Unavailable\r\n"
+                "Connection: close\r\nContent-Length: 0\r\n\r\n");
+            return;
+        }
+        memset(r, 0, sizeof(StaticRanges));
+        r->file = *f;
+        r->multipart = (count > 1);
+        r->count = count;
+        r->pos = ranges[0].start;
+        memcpy(r->ranges, ranges, count * sizeof(ByteRange));
+        snprintf(r->boundary, sizeof(r->boundary), "%08x%08x", (unsigned)time(NULL),
+            (unsigned)(uintptr_t)r);
+    }
+
+    p += sprintf(p, "HTTP/1.1 206 Partial Content\r\nConnection: %s\r\n", HTTPConnectionValue(res));
+    if (r && r->multipart) {
+        length = 0;
+        for (i = 0; i <= count; i++) {
+            length += _RangePartHeader(r, i, NULL, 0);
+            if (i < count)
+                length += ranges[i].end - ranges[i].start + 1;
+        }
+        p += sprintf(p, "Content-Type: multipart/byteranges; boundary=%s\r\n", r->boundary);
+        r->text_length = _RangePartHeader(r, 0, r->text, sizeof(r->text));
+    } else {
+        length = ranges[0].end - ranges[0].start + 1;
+        p += sprintf(p, "Content-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n",
+            f->mime_type, ranges[0].start, ranges[0].end, f->length);
+    }
+    p += sprintf(p, "Content-Length: %ld\r\n", length);
+    p = _StaticValidators(p, f);
+    p = _StaticCoding(p, f);
+    p += sprintf(p, "\r\n");
+    res->_index = p - (char *)res->_buf;
+
+    if (r) {
+        res->BodyCB = &_RangesOut;
+        res->BodyRelease = &_RangesRelease;
+        res->BodyContext = r;
+    } else if (f->data) {
+        res->BodyData = f->data + ranges[0].start;
+        res->BodyDataLength = length;
+        res->BodyRelease = f->release;
+        res->BodyContext = f->release_context;
+#if HTTP_USE_SENDFILE
+    } else {
+        res->BodyFd = f->fd;
+        res->BodyOffset = ranges[0].start;
+        res->BodyLength = (size_t)length;
+#endif
+    }
+}
+
+/* Build the 200 response for a static file. The length delimits the body,
+   so the connection can be kept open. */
+static void _SendStaticFile(HTTPReqMessage *req, HTTPRespMessage *res, StaticFile *f)
+{
+    char *p = (char *)res->_buf;
+    char *tail = NULL;
+    const char *range;
+
+    if (_NotModified(req, f)) {
+        _SendNotModified(req, res, f);
+        return;
+    }
+    if ((req->Header.Method == HTTP_GET) && ((range = GetReqHeaderById(req, HTTP_HDR_RANGE)) != NULL) &&
+        _IfRangeMatches(req, f)) {
+        ByteRange ranges[HTTP_MAX_RANGES];
+        int count = _ParseRange(range, f->length, ranges, HTTP_MAX_RANGES);
+        if (count >= 0) {
+            _SendStaticRanges(req, res, f, ranges, count);
+            return;
+        }
+    }
+
+    res->KeepAlive = req->KeepAlive;
+    p += sprintf(p, "HTTP/1.1 200 OK\r\nConnection: %s\r\nAccept-Ranges: bytes\r\n", HTTPConnectionValue(res));
+    if (f->header && f->data && (req->Header.Method != HTTP_HEAD)) {
+        /* The prebuilt lines live as long as the body: send them from where
+           they are, between the status line and the rest of the header. */
+        res->_index = p - (char *)res->_buf;
+        tail = p;
+        HTTPRespAppend(res, f->header, f->header_length);
+    } else if (f->header) {
+        memcpy(p, f->header, f->header_length);
+        p += f->header_length;
+    } else {
+        p += sprintf(p, "Content-Type: %s\r\nContent-Length: %ld\r\n", f->mime_type, f->length);
+        p = _StaticValidators(p, f);
+    }
+    p = _StaticCoding(p, f);
+    p += sprintf(p, "\r\n");
+    if (tail)
+        HTTPRespAppend(res, tail, p - tail);
+    else
+        res->_index = p - (char *)res->_buf;
+
+    if (req->Header.Method == HTTP_HEAD) {
+        _DropStaticBody(f); // same header as GET, no body
+    } else if (f->data) {
+        res->BodyData = f->data;
+        res->BodyDataLength = f->length;
+        res->BodyRelease = f->release;
+        res->BodyContext = f->release_context;
+#if HTTP_USE_SENDFILE
+    } else if (f->fd >= 0) {
+        // the connection sends the file with sendfile() and closes it
+        res->BodyFd = f->fd;
+        res->BodyOffset = 0;
+        res->BodyLength = (size_t)f->length;
+#endif
+    } else if (f->fp) {
+        res->BodyCB = &filestream_out;
+        res->BodyContext = f->fp;
+        res->BodyRelease = &_FileStreamClose;
+    }
+}
+
+/* Send the file at path from the RAM cache ('cached': its entry, when it was
+   looked up already) or from disk. Returns 0 when there is no such file. */
+static int _SendStaticPath(HTTPReqMessage *req, HTTPRespMessage *res, const char *path, StaticFile *f, void *cached)
+{
+#if (ENABLE_STATIC_FILE == 1) && HTTP_STATIC_CACHE_SIZE
+    /* Hot files are answered from RAM, with their prebuilt header lines. */
+    StaticCacheEntry *entry = cached ? (StaticCacheEntry *)cached : StaticCacheLookup(path, f->mime_type, NULL, NULL);
+    if (entry) {
+        f->length = (long)entry->length;
+        f->mtime = entry->mtime;
+        f->etag = entry->etag;
+        f->header = entry->header;
+        f->header_length = entry->header_length;
+        f->data = entry->body;
+        f->release = &StaticCacheRelease;
+        f->release_context = entry;
+        _SendStaticFile(req, res, f);
+        return 1;
+    }
+#else
+    (void)cached;
+#endif
+
+#if HTTP_USE_SENDFILE
+    struct stat st;
+    char etag[40];
+    f->fd = open(path, O_RDONLY);
+    if ((f->fd >= 0) && ((fstat(f->fd, &st) != 0) || !S_ISREG(st.st_mode))) {
+        close(f->fd);
+        f->fd = -1;
+    }
+    if (f->fd >= 0) {
+        f->length = (long)st.st_size;
+        f->mtime = st.st_mtime;
+        StaticFileETag(etag, sizeof(etag), st.st_mtime, (size_t)st.st_size);
+        f->etag = etag;
+        _SendStaticFile(req, res, f);
+        return 1;
+    }
+#else
+    f->fp = fopen(path, "r");
+    if (f->fp != NULL) {
+        fseek(f->fp, 0, SEEK_END);
+        f->length = ftell(f->fp);
+        fseek(f->fp, 0, SEEK_SET);
+#if ENABLE_STATIC_FILE == 1
+        struct stat st;
+        char etag[40];
+        if (stat(path, &st) == 0) {
+            f->mtime = st.st_mtime;
+            StaticFileETag(etag, sizeof(etag), st.st_mtime, (size_t)st.st_size);
+            f->etag = etag;
+        }
+#endif
+        _SendStaticFile(req, res, f);
+        return 1;
+    }
+#endif
+    return 0;
+}
 
 /* Try to read static files under static folder. */
 uint8_t _ReadStaticFiles(HTTPReqMessage *req, HTTPRespMessage *res)
@@ -70,17 +659,12 @@ uint8_t _ReadStaticFiles(HTTPReqMessage *req, HTTPRespMessage *res)
 //        return 0;
 //    }
 
-    uint8_t found = 0;
     int8_t depth = 0;
     const char *uri = req->Header.URI;
     size_t n = strlen(uri);
     size_t i;
-
-    FILE *fp;
     char path[128] = {STATIC_FILE_FOLDER};
-
-    const char header[] = "HTTP/1.1 200 OK\r\nConnection: close\r\n"
-                    "Content-Type: %s\r\n\r\n";
+    StaticFile f;
 
     /* Prevent Path Traversal. */
     for (i = 0; i < n; i++) {
@@ -95,49 +679,148 @@ uint8_t _ReadStaticFiles(HTTPReqMessage *req, HTTPRespMessage *res)
                 depth += 1;
         }
     }
+    if ((depth < 0) || (sizeof(STATIC_FILE_FOLDER) + n + sizeof("/index.html") > sizeof(path)))
+        return 0;
 
-    if (depth >= 0) {
-        /* Try to open and load the static file. */
-        strcat(path, uri);
-        int corr = 0;
-        if (path[strlen(path)-1] == '/') {
-            path[strlen(path)-1] = 0; // cut last slash
-            corr = 1;
-        }
-        if ((strlen(uri) - corr) == 0) {
-            strcat(path, "/index.html");
-        }
-
-        fp = fopen(path, "r");
-        if (fp != NULL) {
-            /* Build HTTP OK header. */
-            n = sprintf((char *)res->_buf, header, get_mime_type(path));
-            i = n;
-            found = 1;
-            res->_index = i;
+    /* Try to open and load the static file. */
+    strcat(path, uri);
+    int corr = 0;
+    if (path[strlen(path)-1] == '/') {
+        path[strlen(path)-1] = 0; // cut last slash
+        corr = 1;
+    }
+    if ((strlen(uri) - corr) == 0) {
+        strcat(path, "/index.html");
+    }
 
-            // always switch to streaming mode
-            res->BodyCB = &filestream_out;
-            res->BodyContext = fp;
+    memset(&f, 0, sizeof(f));
+    f.fd = -1;
 
+#if HTTP_EMBEDDED_FS
+    /* Files compiled into the binary are answered from ROM. */
+    const EmbeddedFile *file = EmbeddedFSLookup(path + strlen(STATIC_FILE_FOLDER));
+    if (file) {
+        const char *accept = GetReqHeaderById(req, HTTP_HDR_ACCEPT_ENCODING);
+        f.mime_type = file->mime_type;
+        f.mtime = file->mtime;
+        f.etag = file->etag;
+        f.vary = (file->gzip_data != NULL);
+        if (f.vary && accept && _AcceptsEncoding(accept, "gzip")) {
+            f.encoding = "gzip";
+            f.etag = file->gzip_etag; // a representation of its own (RFC 9110, 8.8.3)
+            f.data = file->gzip_data;
+            f.length = file->gzip_length;
         } else {
-            printf("Not found: '%s'\n", path);
+            f.data = file->data;
+            f.length = file->length;
         }
+        _SendStaticFile(req, res, &f);
+        return 1;
     }
+#endif
 
-    return found;
+    f.mime_type = get_mime_type(path);
+    void *entry = NULL;
+#if ENABLE_STATIC_FILE == 1
+    /* A file that is compressed itself has no precompressed siblings. */
+    const char *const *suffixes = _IsPrecompressed(path) ? NULL : precompressed_suffixes;
+    unsigned siblings = 0;
+    size_t length = strlen(path);
+#if HTTP_STATIC_CACHE_SIZE
+    entry = StaticCacheLookup(path, f.mime_type, suffixes, &siblings);
+    if (!entry)
+#endif
+        siblings = StaticFileSiblings(path, suffixes);
+    f.vary = (siblings != 0);
+    f.encoding = _SelectPrecompressed(req, path, sizeof(path), siblings);
+    if (f.encoding) {
+        if (entry)
+            StaticCacheRelease(entry);
+        entry = NULL;
+        if (_SendStaticPath(req, res, path, &f, NULL))
+            return 1;
+        /* The sibling went away since it was seen: send the file itself. */
+        path[length] = '\0';
+        f.encoding = NULL;
+    }
+#endif
+    if (_SendStaticPath(req, res, path, &f, entry))
+        return 1;
+    printf("Not found: '%s'\n", path);
+    return 0;
 }
 #endif
 
 void _NotFound(HTTPReqMessage *req, HTTPRespMessage *res)
 {
-    uint8_t n;
-    char header[] = "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n";
+    const char header[] = "HTTP/1.1 404 Not Found\r\nConnection: %s\r\nContent-Length: 0\r\n\r\n";
 
-    /* Build HTTP OK header. */
-    n = strlen(header);
-    memcpy(res->_buf, header, n);
-    res->_index = n;
+    /* Build HTTP Not Found header. */
+    res->KeepAlive = req->KeepAlive;
+    res->_index = sprintf((char *)res->_buf, header, HTTPConnectionValue(res));
+}
+
+#ifdef HTTP_UPLOAD_FOLDER
+/* Append one line per stored file to the response, which is sent when the
+   body is complete. */
+static void _UploadReport(void *context, const FileSinkResult *result)
+{
+    HTTPRespMessage *res = (HTTPRespMessage *)context;
+    int space = HTTP_BUFFER_SIZE - (int)res->_index;
+    int n;
+
+    if (result->error) {
+        n = snprintf((char *)res->_buf + res->_index, space, "%s: %s\n", result->name, strerror(result->error));
+    } else {
+        uint32_t ms = result->usec / 1000;
+        double mbps = result->usec ? (double)result->size / result->usec : 0.0; // bytes/us = MB/s
+        n = snprintf((char *)res->_buf + res->_index, space, "%s: %lu bytes, %lu ms, %.1f MB/s\n",
+            result->name, (unsigned long)result->size, (unsigned long)ms, mbps);
+    }
+    if ((n > 0) && (n < space))
+        res->_index += n;
+}
+
+/* Store the files of the request body in HTTP_UPLOAD_FOLDER. The response is
+   delimited by closing the connection, like the one of Api(). */
+static void _UploadFiles(HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    const char header[] = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Type: text/plain\r\n\r\n";
+    FileSink_t *sink;
+
+    res->KeepAlive = 0;
+    if (req->bodyType == eNoBody) {
+        res->_index = sprintf((char *)res->_buf, "HTTP/1.1 400 Bad Request\r\n"
+            "Connection: close\r\nContent-Length: 0\r\n\r\n");
+        return;
+    }
+    sink = FileSinkCreate(HTTP_UPLOAD_FOLDER, "upload.bin", &_UploadReport, res);
+    if (!sink) {
+        res->_index = sprintf((char *)res->_buf, "HTTP/1.1 503 Service Unavailable\r\n"
+            "Connection: close\r\nContent-Length: 0\r\n\r\n");
+        return;
+    }
+    res->_index = sprintf((char *)res->_buf, header);
+    setup_multipart(req, &file_sink_block, sink);
+}
+#endif
+
+/* OPTIONS is answered for the whole server, without routing. */
+void _Options(HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    const char header[] = "HTTP/1.1 204 No Content\r\nConnection: %s\r\n"
+        "Allow: GET, HEAD, POST, PUT, DELETE, PATCH, OPTIONS\r\n\r\n";
+
+    res->KeepAlive = req->KeepAlive;
+    res->_index = sprintf((char *)res->_buf, header, HTTPConnectionValue(res));
+}
+
+void _NotImplemented(HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    const char header[] = "HTTP/1.1 501 Not Implemented\r\nConnection: %s\r\nContent-Length: 0\r\n\r\n";
+
+    res->KeepAlive = req->KeepAlive;
+    res->_index = sprintf((char *)res->_buf, header, HTTPConnectionValue(res));
 }
 
 /* Dispatch an URI according to the route table. */
@@ -145,19 +828,36 @@ void Dispatch(HTTPReqMessage *req, HTTPRespMessage *res)
 {
     uint8_t found = 0;
 
+    switch (req->Header.Method) {
+        case HTTP_OPTIONS:
+            _Options(req, res);
+            return;
+        case HTTP_CONNECT: // not a proxy
+        case HTTP_TRACE:
+        case HTTP_UNKNOWN:
+            _NotImplemented(req, res);
+            return;
+        default:
+            break;
+    }
+
+#ifdef HTTP_UPLOAD_FOLDER
+    if (((req->Header.Method == HTTP_POST) || (req->Header.Method == HTTP_PUT)) &&
+        !strcmp(req->Header.URI, HTTP_UPLOAD_URI)) {
+        _UploadFiles(req, res);
+        return;
+    }
+#endif
+
     // By default, there is no callback installed for the body data
     // such that it gets ditched properly.
 
     if (found != 1) {
-#if ENABLE_STATIC_FILE == 2 // Running on Ultimate
-        if (execute_api_v1(req, res) == 0) {
+        if (RouteTableDispatch(req, res) == 0) {
             found = 1;
         }
-#else
-        UrlComponents *c;
-        if ((c = parse_url_header(&req->Header)) != NULL) {
-            Api(c, req, res);
-            delete_url_components(c);
+#if ENABLE_STATIC_FILE == 2 // Running on Ultimate
+        else if (execute_api_v1(req, res) == 0) {
             found = 1;
         }
 #endif
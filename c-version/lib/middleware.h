@@ -14,6 +14,18 @@
 #define STATIC_FILE_FOLDER "/Flash/html"
 #endif
 
+/* Most ranges a static file Range request may ask for; a request with more
+   is answered with the whole file. */
+#ifndef HTTP_MAX_RANGES
+#define HTTP_MAX_RANGES 8
+#endif
+
+/* Define HTTP_UPLOAD_FOLDER (e.g. -DHTTP_UPLOAD_FOLDER=\"uploads\") to store the
+   files of a POST or PUT to HTTP_UPLOAD_URI in that folder (see file_sink.h). */
+#ifndef HTTP_UPLOAD_URI
+#define HTTP_UPLOAD_URI "/upload"
+#endif
+
 /* Data type of server application function */
 void Dispatch(HTTPReqMessage *, HTTPRespMessage *);
 
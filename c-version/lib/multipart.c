@@ -9,26 +9,47 @@ typedef enum {
     eDitch,
     eHeader,
     eData,
+    eEpilogue,
     eTerminated,
 } stream_state_t;
 
+/* RFC 2046: a boundary has 1 to 70 characters. */
+#define MULTIPART_MAX_BOUNDARY 70
+
 typedef struct _FileStream
 {
     stream_state_t state;
     const char *type;
-    char *boundary;
+    char boundary[4 + MULTIPART_MAX_BOUNDARY + 1]; // "\r\n--" + boundary
     int boundary_length;
-    int match_state;
+    int match_state;    // boundary bytes matched at the end of the previous chunk, or header end bytes
+    uint8_t skip[256];  // Boyer-Moore-Horspool shift for each byte value
     char header[1024];
     int header_size;
-    char data[4096];
-    int data_size;
     int field_count;
     HTTPHeaderField fields[8];
     BODY_DATABLOCK_CB block_cb;
     void *block_context;
 } FileStream_t;
 
+/* The stream belongs to the request message and serves every multipart body
+   it receives, so a connection allocates it once for all of its uploads. It
+   is freed with the message (ReleaseReqMessage). */
+static FileStream_t *_StreamAcquire(HTTPReqMessage *req)
+{
+    FileStream_t *stream = (FileStream_t *)req->_multipart;
+
+    if (!stream) {
+        stream = (FileStream_t *)malloc(sizeof(FileStream_t));
+        if (!stream) {
+            return NULL;
+        }
+        req->_multipart = stream;
+    }
+    memset(stream, 0, sizeof(FileStream_t)); // also sets the state to eInit
+    return stream;
+}
+
 // A multipart form is structured like this:
 // (--, SEPARATOR, \r\n, (HEADER FIELD, \r\n)+, \r\n, DATA)+), --, SEPARATOR, \r\n.
 // When the separator to search for is extended with as --SEP\r\n, and the \r\n are included in the header fields, this
@@ -36,59 +57,59 @@ typedef struct _FileStream
 // (SEPARATOR, (HEADER FIELD)+, EMPTY_LINE, DATA)+, SEPARATOR.
 //
 // The chosen approach is pattern searching on the fly. In this approach, the separator search state machine is extended
-// to also handle the header as well. Separate buffers are created to store the three different types of data that
-// the multipart stream header contains:
-// - Header Bytes
-// - Data Bytes
-// Storing separator bytes is not necessary because they are constant. Still, these bytes will turn out to be data bytes
-// as soon as it turns out that not the entire separator matches. Then these bytes need to be added to the data bytes.
-// The data bytes buffer not strictly needed, but might facilitate writing the data to a device that requires alignment.
-// Storing the header bytes facilitates in parsing the header, because this guarantees that all the data is
-// sequential, and doesn't wrap around the boundaries of a circular buffer, as is the case with a FIFO.
+// to also handle the header as well. Only the header bytes are stored, which facilitates in parsing the header, because
+// this guarantees that all the data is sequential. Data bytes are passed on where they were received: each eDataBlock
+// points into the received chunk. Storing separator bytes is not necessary because they are constant. Still, these
+// bytes will turn out to be data bytes as soon as it turns out that not the entire separator matches; they are then
+// passed on from the separator string itself.
 // The state machine should have the following states:
 // [ wait_separator, separator, header, data ]. In the first state, all non-matching data is thrown away.
+//
+// The separator is searched with Boyer-Moore-Horspool over each received chunk, so most data bytes are
+// skipped rather than compared. A chunk that ends with the start of a separator leaves the number of
+// matched bytes in match_state; those bytes are always a prefix of the separator, so they need not be
+// stored, and they are data after all when the next chunk does not complete the separator.
 
 static void _ParseMultiPartHeader(FileStream_t *stream)
 {
-    char *p = (char *)stream->header + 2;
-    char *lines[8];
-    int line = 0;
-    p[stream->header_size] = 0;
-
-    // First split the header buffer into lines by searching for the \r\n sequences
-    // The method used here is to separate on \r and skip the following \n.
-    for(line = 0; line < 8; line++) {
-        lines[line] = strsep(&p, "\r");
-        if (!p) {
-            break;
-        }
-        p++; // skip the \n
-        if (! *(lines[line])) {
-            break;
-        }
+    char *p = (char *)stream->header;
+    char *end = p + stream->header_size;
+    int count = 0;
+
+    *end = 0;
+    if ((end - p >= 2) && (p[0] == '\r') && (p[1] == '\n')) {
+        p += 2; // the line break that ends the separator
     }
-    // p is now pointing to the byte after the header, if any.
 
-    // Step 2: Split the remaining lines into fields.
-    // All subsequent lines are in the form of KEY ": " VALUE, although the space is not mandatory by spec.
-    // so leading spaces need to be trimmed, and the separator is simply ':'
-    int count = 0;
-    for(line = 0; line < 8; line++) {
-        if (! *(lines[line])) {
-            break;
+    // Split the header into lines at each \r\n, and the lines into fields.
+    // All lines are in the form of KEY ":" VALUE, although the space is not mandatory by spec,
+    // so leading spaces need to be trimmed, and the separator is simply ':'. A header that was
+    // truncated to the size of the buffer ends without \r\n.
+    while ((p < end) && (count < (int)(sizeof(stream->fields) / sizeof(HTTPHeaderField)))) {
+        char *eol = strstr(p, "\r\n");
+        char *colon;
+        if (!eol) {
+            eol = end;
         }
-        p = lines[line];
-        stream->fields[count].key = strsep(&p, ":");
-        if (p) {
-            while(*p == ' ') {
-                p++;
-            }
-            stream->fields[count].value = p;
-            // printf("'%s' -> '%s'\n", stream->fields[count].key, stream->fields[count].value);
-            count++;
-        } else {
+        if (eol == p) {
+            break; // empty line
+        }
+        *eol = 0;
+        colon = (char *)memchr(p, ':', eol - p);
+        if (!colon) {
             break;
         }
+        *colon = 0;
+        stream->fields[count].key = p;
+        p = colon + 1;
+        while(*p == ' ') {
+            p++;
+        }
+        stream->fields[count].value = p;
+        stream->fields[count].id = HTTPHeaderLookup(stream->fields[count].key, colon - stream->fields[count].key);
+        // printf("'%s' -> '%s'\n", stream->fields[count].key, stream->fields[count].value);
+        count++;
+        p = eol + 2;
     }
     stream->field_count = count;
 
@@ -130,20 +151,160 @@ void attachment_block_debug(BodyDataBlock_t *block)
     }
 }
 
-static void expunge(FileStream_t *stream)
+/* Data bytes of the current part, passed on without copying; bytes before
+   the first separator are dropped. */
+static void _DataOut(FileStream_t *stream, const char *p, int n)
 {
-    if (stream->block_cb) {
-        BodyDataBlock_t block = (BodyDataBlock_t){ eDataBlock, stream->data, stream->data_size, stream->block_context };
+    if ((stream->state == eData) && (n > 0) && stream->block_cb) {
+        BodyDataBlock_t block = { eDataBlock, p, n, stream->block_context };
         stream->block_cb(&block);
     }
-    stream->data_size = 0;
 }
 
-static int filestream_in(void *context, const uint8_t *buf, int len)
+static void _EndOfPart(FileStream_t *stream)
 {
-    FileStream_t *stream = (FileStream_t *)context;
+    if (stream->state == eData) {
+        if (stream->block_cb) {
+            BodyDataBlock_t block = { eDataEnd, NULL, 0, stream->block_context };
+            stream->block_cb(&block);
+        }
+    }
+}
+
+static void _SeparatorFound(FileStream_t *stream)
+{
+    _EndOfPart(stream);
+    // After a separator there is always a header, or "--" after the last one.
+    stream->state = eHeader;
+    stream->header_size = 0;
+    stream->match_state = 0;
+}
 
+/* Search buf for the separator, passing the bytes before it on as data.
+   Returns the number of bytes consumed: up to the end of the separator, or
+   all of them when the separator does not end in this chunk. */
+static int _SearchSeparator(FileStream_t *stream, const uint8_t *buf, int len)
+{
+    const char *sep = stream->boundary;
+    int m = stream->boundary_length;
+    int k = stream->match_state;
+    int i, t;
+
+    if (k) {
+        /* The previous chunk ended with sep[0..k). The separator starts either
+           in those carried bytes, or in this chunk. */
+        for (int j = 0; j < k; j++) {
+            int avail = k - j + len; // bytes from sep[j] on in carry + buf
+            int n = (avail < m) ? avail : m;
+            int q;
+            for (q = 0; q < n; q++) {
+                char c = (j + q < k) ? sep[j + q] : (char)buf[j + q - k];
+                if (c != sep[q]) {
+                    break;
+                }
+            }
+            if (q < n) {
+                continue;
+            }
+            _DataOut(stream, sep, j);
+            if (n == m) {
+                _SeparatorFound(stream);
+                return m - (k - j);
+            }
+            stream->match_state = avail; // still incomplete
+            return len;
+        }
+        _DataOut(stream, sep, k);
+        stream->match_state = 0;
+    }
+
+    /* Boyer-Moore-Horspool: compare at the last byte of the window first, and
+       shift by the distance of that byte to the end of the separator. */
+    for (i = 0; i + m <= len; i += stream->skip[buf[i + m - 1]]) {
+        if ((buf[i + m - 1] == (uint8_t)sep[m - 1]) && !memcmp(buf + i, sep, m - 1)) {
+            _DataOut(stream, (const char *)buf, i);
+            _SeparatorFound(stream);
+            return i + m;
+        }
+    }
+
+    // Keep the longest tail that may be the start of a separator.
+    for (t = (len < m - 1) ? len : m - 1; t > 0; t--) {
+        if (!memcmp(buf + len - t, sep, t)) {
+            break;
+        }
+    }
+    _DataOut(stream, (const char *)buf, len - t);
+    stream->match_state = t;
+    return len;
+}
+
+/* Collect the part header up to its empty line. Returns the number of bytes
+   consumed. */
+static int _HeaderIn(FileStream_t *stream, const uint8_t *buf, int len)
+{
     static const char c_header_end[5] = "\r\n\r\n";
+
+    for (int i = 0; i < len; i++) {
+        /* Bound the header buffer (_ParseMultiPartHeader writes a NUL at
+           header[header_size]); silently truncate an over-long part header
+           rather than overflow into fields[]/the callback pointers. */
+        if (stream->header_size < (int)sizeof(stream->header) - 3) {
+            stream->header[stream->header_size++] = buf[i];
+        }
+        if ((stream->header_size == 2) && (stream->header[0] == '-') && (stream->header[1] == '-')) {
+            stream->state = eEpilogue; // the last separator
+            return len;
+        }
+        if (buf[i] == c_header_end[stream->match_state]) {
+            stream->match_state++;
+        } else {
+            stream->match_state = (buf[i] == '\r') ? 1 : 0;
+        }
+        if (stream->match_state == 4) {
+            // After the empty line of the header there is always data.
+            _ParseMultiPartHeader(stream);
+            stream->state = eData;
+            stream->header_size = 0;
+            stream->match_state = 0;
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+/* Take the boundary parameter from the Content-Type, which may be quoted. */
+static int _SetBoundary(FileStream_t *stream, const char *b)
+{
+    const char *end;
+    int len;
+
+    if (*b == '"') {
+        end = strchr(++b, '"');
+    } else {
+        end = b + strcspn(b, "; \t");
+    }
+    len = end ? (int)(end - b) : 0;
+    if ((len < 1) || (len > MULTIPART_MAX_BOUNDARY)) {
+        printf("invalid boundary in multipart\n");
+        return -1;
+    }
+    memcpy(stream->boundary, "\r\n--", 4);
+    memcpy(stream->boundary + 4, b, len);
+    stream->boundary[len + 4] = 0;
+    stream->boundary_length = len + 4;
+    for (int i = 0; i < 256; i++) {
+        stream->skip[i] = (uint8_t)stream->boundary_length;
+    }
+    for (int i = 0; i < stream->boundary_length - 1; i++) {
+        stream->skip[(uint8_t)stream->boundary[i]] = (uint8_t)(stream->boundary_length - 1 - i);
+    }
+    return 0;
+}
+
+static int filestream_in(void *context, const uint8_t *buf, int len)
+{
+    FileStream_t *stream = (FileStream_t *)context;
     const char *b;
 
     /* A negative length signals that the connection was torn down before the
@@ -156,10 +317,7 @@ static int filestream_in(void *context, const uint8_t *buf, int len)
             BodyDataBlock_t block = { eAbort, NULL, 0, stream->block_context };
             stream->block_cb(&block);
         }
-        if (stream->boundary) {
-            free(stream->boundary);
-        }
-        free(stream);
+        stream->state = eTerminated;
         return len;
     }
 
@@ -172,26 +330,15 @@ static int filestream_in(void *context, const uint8_t *buf, int len)
             }
             if (!strncasecmp(stream->type, "multipart", 9)) { // 9 chars
                 b = strstr(stream->type, "boundary="); // 9 chars
-                if (b) {
-                    len = strlen(b+9);
-                    stream->boundary = (char *)malloc(len + 5); // \r\n-- + len + \r\n\0
-                    if (stream->boundary) {
-                        stream->boundary[0] = '\r';
-                        stream->boundary[1] = '\n';
-                        stream->boundary[2] = '-';
-                        stream->boundary[3] = '-';
-                        strcpy(stream->boundary + 4, b + 9);
-                        stream->boundary[len+4] = 0;
-                        stream->boundary_length = strlen(stream->boundary);
-                        stream->match_state = 2; // the data we receive starts with a boundary, but without the \r\n
-                        stream->state = eDitch;
-                        return 0;
-                    }
-                    /* Out of memory: fall through to the raw-binary path below so the
-                       downstream absorber still gets eDataStart and the body is treated
-                       as opaque, instead of dereferencing a NULL boundary. */
-                    len = 0;
-                } else {
+                if (b && (_SetBoundary(stream, b + 9) == 0)) {
+                    stream->match_state = 2; // the data we receive starts with a boundary, but without the \r\n
+                    stream->state = eDitch;
+                    return 0;
+                }
+                /* No usable boundary: fall through to the raw-binary
+                   path below so the downstream absorber still gets eDataStart and the
+                   body is treated as opaque. */
+                if (!b) {
                     printf("boundary not found in multipart\n");
                 }
             }
@@ -213,8 +360,7 @@ static int filestream_in(void *context, const uint8_t *buf, int len)
                     BodyDataBlock_t block = { eTerminate, NULL, 0, stream->block_context };
                     stream->block_cb(&block);
                 }
-                // Since we are the owner of this struct, we can free it
-                free(stream);
+                stream->state = eTerminated;
             } else {
                 if (stream->block_cb) {
                     BodyDataBlock_t block = { eDataBlock, (const char *)buf, len, stream->block_context };
@@ -226,110 +372,23 @@ static int filestream_in(void *context, const uint8_t *buf, int len)
         case eDitch: // idle, looking for separator to start with
         case eData:
         case eHeader:
-            // all states together, because this is where this function
-            // enters. Could have done this with a sub state
-            for(int i=0;i<len;i++) {
-                if (stream->state != eHeader) {
-                    if (stream->match_state == stream->boundary_length) {
-                        stream->match_state = 0;
-                        if (stream->data_size) {
-                            expunge(stream);
-                        }
-                        if ((stream->block_cb) && (stream->state == eData)) {
-                            BodyDataBlock_t block = { eDataEnd, NULL, 0, stream->block_context };
-                            stream->block_cb(&block);
-                        }
-                        // After a separator there is always a header.
-                        // If the header is 0 bytes, we are done.
-                        stream->state = eHeader;
-                        stream->header_size = 0;
-                    } else if (buf[i] == stream->boundary[stream->match_state]) {
-                        stream->match_state++;
-                    } else if (stream->match_state != 0) {
-                        switch(stream->state) {
-                            case eHeader:
-                                /* Bound the header buffer (_ParseMultiPartHeader uses header+2 and
-                                   writes a NUL at header[2+header_size]); drop bytes past capacity
-                                   instead of overflowing the FileStream_t struct. */
-                                if (stream->header_size + stream->match_state <= (int)sizeof(stream->header) - 3) {
-                                    memcpy(stream->header + stream->header_size, stream->boundary, stream->match_state);
-                                    stream->header_size += stream->match_state;
-                                }
-                                break;
-                            case eData:
-                                // printf("copying boundary bytes to data %d (pos in data: %d)\n", stream->match_state, i);
-                                for(int j=0;j<stream->match_state;j++) {
-                                    stream->data[stream->data_size++] = stream->boundary[j];
-                                    if (stream->data_size == 4096) {
-                                        expunge(stream);
-                                    }
-                                }
-                                break;
-                            default:
-                                printf("unknown state %c\n", buf[i]);
-                        }
-                        if (buf[i] == stream->boundary[0]) {
-                            stream->match_state = 1;
-                        } else {
-                            stream->match_state = 0;
-                        }
-                    }
+        case eEpilogue:
+            for (int i = 0; (i < len) && (stream->state != eEpilogue); ) {
+                if (stream->state == eHeader) {
+                    i += _HeaderIn(stream, buf + i, len - i);
                 } else {
-                    // in header state
-                    if (stream->match_state == 4) {
-                        stream->match_state = 0;
-                        // After the empty line of the header there is always data.
-                        _ParseMultiPartHeader(stream);
-                        // If the header is 0 bytes, we are done.
-                        stream->state = eData;
-                        stream->header_size = 0;
-                    } else if (buf[i] == c_header_end[stream->match_state]) {
-                        stream->match_state++;
-                    } else {
-                        stream->match_state = 0;
-                    }
-                }
-                // where to store the byte?
-                switch(stream->state) {
-                    case eData:
-                        if (stream->match_state == 0) {
-                            stream->data[stream->data_size++] = buf[i];
-                            if (stream->data_size == 4096) {
-                                expunge(stream);
-                            }
-                        }
-                        break;
-                    case eHeader:
-                        /* Bound the header buffer (see note above); silently truncate an
-                           over-long part header rather than overflow into data[]/fields[]/
-                           the callback pointers. */
-                        if (stream->header_size < (int)sizeof(stream->header) - 3) {
-                            stream->header[stream->header_size++] = buf[i];
-                        }
-                        break;
-                    case eDitch:
-                        break;
-                    default:
-                        printf("store %d %c\n", stream->state, buf[i]);
+                    i += _SearchSeparator(stream, buf + i, len - i);
                 }
             }
             if (len == 0) {
+                // A body that ends without the last separator ends the open part.
+                _DataOut(stream, stream->boundary, stream->match_state);
+                _EndOfPart(stream);
                 stream->state = eTerminated;
-                if (stream->data_size) {
-                    expunge(stream);
-                    if (stream->block_cb) {
-                        BodyDataBlock_t block = { eDataEnd, NULL, 0, stream->block_context };
-                        stream->block_cb(&block);
-                    }
-                }
                 if (stream->block_cb) {
                     BodyDataBlock_t block = { eTerminate, NULL, 0, stream->block_context };
                     stream->block_cb(&block);
                 }
-                if(stream->boundary) {
-                    free(stream->boundary);
-                }
-                free(stream);
             }
             break;
 
@@ -342,7 +401,7 @@ static int filestream_in(void *context, const uint8_t *buf, int len)
 
 void setup_multipart(HTTPReqMessage *req, BODY_DATABLOCK_CB data_cb, void *data_context)
 {
-    FileStream_t *stream = (FileStream_t *)malloc(sizeof(FileStream_t));
+    FileStream_t *stream = _StreamAcquire(req);
     if (!stream) {
         /* Out of memory: leave no body callback so the body is ditched instead
            of dereferencing a NULL stream. */
@@ -351,7 +410,6 @@ void setup_multipart(HTTPReqMessage *req, BODY_DATABLOCK_CB data_cb, void *data_
         return;
     }
     req->BodyCB = &filestream_in;
-    memset(stream, 0, sizeof(FileStream_t)); // also sets the state to eInit
     req->BodyContext = stream;
     stream->type = req->ContentType ? req->ContentType : "";
     stream->block_cb = data_cb;
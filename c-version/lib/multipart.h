@@ -17,6 +17,8 @@ typedef enum {
     eAbort,
 } BlockType_t;
 
+/* For eDataBlock, data points into the received body (or into the boundary
+   string) and is only valid during the callback; blocks may be of any size. */
 typedef struct {
     BlockType_t type;
     const char *data;
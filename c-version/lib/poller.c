@@ -0,0 +1,170 @@
+#include "server.h"
+#include <errno.h>
+#include <string.h>
+
+#if HTTP_USE_EPOLL
+
+int HTTPPollerInit(HTTPPoller *p)
+{
+    p->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return (p->epfd < 0) ? -1 : 0;
+}
+
+void HTTPPollerClose(HTTPPoller *p)
+{
+    if (p->epfd >= 0) {
+        close(p->epfd);
+        p->epfd = -1;
+    }
+}
+
+int HTTPPollerAdd(HTTPPoller *p, SOCKET sock, void *context, int events)
+{
+    struct epoll_event ev;
+
+    /* Edge-triggered: register for both directions once, so the interest set
+       never has to be changed (no epoll_ctl per request). The server drains
+       reads and writes until EAGAIN, so no edge is ever lost. */
+    (void)events;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = context;
+    return epoll_ctl(p->epfd, EPOLL_CTL_ADD, sock, &ev);
+}
+
+void HTTPPollerModify(HTTPPoller *p, SOCKET sock, int events)
+{
+    (void)p;
+    (void)sock;
+    (void)events;
+}
+
+void HTTPPollerRemove(HTTPPoller *p, SOCKET sock)
+{
+    struct epoll_event ev; // pre-2.6.9 kernels require a non-NULL event
+    epoll_ctl(p->epfd, EPOLL_CTL_DEL, sock, &ev);
+}
+
+int HTTPPollerWait(HTTPPoller *p, HTTPPollEvent *events, int max, int timeout_ms)
+{
+    struct epoll_event ready[HTTP_POLL_EVENTS];
+    int i, n;
+
+    if (max > HTTP_POLL_EVENTS)
+        max = HTTP_POLL_EVENTS;
+    n = epoll_wait(p->epfd, ready, max, timeout_ms);
+    for (i = 0; i < n; i++) {
+        events[i].context = ready[i].data.ptr;
+        events[i].events = 0;
+        /* Errors and hang-ups are reported as both readable and writable: the
+           next recv()/send() returns the error (or EOF) and closes the client. */
+        if (ready[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            events[i].events |= HTTP_POLL_READ;
+        if (ready[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            events[i].events |= HTTP_POLL_WRITE;
+    }
+    return n;
+}
+
+#else
+
+static void _UpdateMaxSock(HTTPPoller *p)
+{
+    int i;
+
+    p->_max_sock = -1;
+    for (i = 0; i < p->_watch_count; i++) {
+        if (p->_watch[i].sock > p->_max_sock)
+            p->_max_sock = p->_watch[i].sock;
+    }
+}
+
+int HTTPPollerInit(HTTPPoller *p)
+{
+    FD_ZERO(&(p->_read_sock_pool));
+    FD_ZERO(&(p->_write_sock_pool));
+    p->_watch_count = 0;
+    p->_max_sock = -1;
+    return 0;
+}
+
+void HTTPPollerClose(HTTPPoller *p)
+{
+    HTTPPollerInit(p);
+}
+
+int HTTPPollerAdd(HTTPPoller *p, SOCKET sock, void *context, int events)
+{
+    if (p->_watch_count >= (int)(sizeof(p->_watch) / sizeof(p->_watch[0])))
+        return -1;
+    p->_watch[p->_watch_count].sock = sock;
+    p->_watch[p->_watch_count].context = context;
+    p->_watch_count++;
+    if (sock > p->_max_sock)
+        p->_max_sock = sock;
+    HTTPPollerModify(p, sock, events);
+    return 0;
+}
+
+void HTTPPollerModify(HTTPPoller *p, SOCKET sock, int events)
+{
+    if (events & HTTP_POLL_READ)
+        FD_SET(sock, &(p->_read_sock_pool));
+    else
+        FD_CLR(sock, &(p->_read_sock_pool));
+    if (events & HTTP_POLL_WRITE)
+        FD_SET(sock, &(p->_write_sock_pool));
+    else
+        FD_CLR(sock, &(p->_write_sock_pool));
+}
+
+void HTTPPollerRemove(HTTPPoller *p, SOCKET sock)
+{
+    int i;
+
+    /* Remove the fd from BOTH master pools. A closed fd left in the read set
+       makes select() return immediately every iteration, so the server
+       busy-spins and starves the rest of the TCP/IP stack. */
+    FD_CLR(sock, &(p->_read_sock_pool));
+    FD_CLR(sock, &(p->_write_sock_pool));
+    for (i = 0; i < p->_watch_count; i++) {
+        if (p->_watch[i].sock == sock) {
+            p->_watch[i] = p->_watch[--p->_watch_count];
+            break;
+        }
+    }
+    if (sock >= p->_max_sock)
+        _UpdateMaxSock(p);
+}
+
+int HTTPPollerWait(HTTPPoller *p, HTTPPollEvent *events, int max, int timeout_ms)
+{
+    fd_set readable, writeable;
+    struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int i, n = 0;
+
+    /* Copy master socket queue to readable, writeable socket queue. */
+    readable = p->_read_sock_pool;
+    writeable = p->_write_sock_pool;
+    int nready = select(p->_max_sock + 1, &readable, &writeable, NULL, &timeout);
+    if (nready <= 0) {
+        /* select() failed (e.g. interrupted by a signal): the fd_sets are now
+           undefined, so do not inspect them this round. */
+        return nready;
+    }
+    for (i = 0; (i < p->_watch_count) && (n < max); i++) {
+        int ev = 0;
+        if (FD_ISSET(p->_watch[i].sock, &readable))
+            ev |= HTTP_POLL_READ;
+        if (FD_ISSET(p->_watch[i].sock, &writeable))
+            ev |= HTTP_POLL_WRITE;
+        if (ev) {
+            events[n].context = p->_watch[i].context;
+            events[n].events = ev;
+            n++;
+        }
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __MICRO_HTTP_POLLER_H__
+#define __MICRO_HTTP_POLLER_H__
+
+/* Socket readiness backends for HTTPServerRun. This header is included from
+   server.h, after SOCKET, LWIP and MAX_HTTP_CLIENT have been defined.
+
+   Two backends exist:
+   - select(): level-triggered, available everywhere (lwIP / FreeRTOS).
+     Limited to FD_SETSIZE and every wait costs O(number of sockets).
+   - epoll:    edge-triggered, Linux only. A wait only costs O(ready sockets),
+     so the pool can grow to thousands of connections. Because readiness is
+     only reported on a change, the server must read/write until EAGAIN. */
+
+#ifndef HTTP_USE_EPOLL
+#if (LWIP == 0) && defined(__linux__)
+#define HTTP_USE_EPOLL 1
+#else
+#define HTTP_USE_EPOLL 0
+#endif
+#endif
+
+#if HTTP_USE_EPOLL
+#include <sys/epoll.h>
+#define HTTP_POLLER_EDGE 1
+#else
+#define HTTP_POLLER_EDGE 0
+#endif
+
+/* Maximum number of events handled per HTTPServerRun() iteration. */
+#ifndef HTTP_POLL_EVENTS
+#if HTTP_USE_EPOLL
+#define HTTP_POLL_EVENTS 64
+#else
+#define HTTP_POLL_EVENTS (MAX_HTTP_CLIENT + 1)
+#endif
+#endif
+
+#define HTTP_POLL_READ  1
+#define HTTP_POLL_WRITE 2
+
+typedef struct _HTTPPollEvent
+{
+    void *context;
+    int events;
+} HTTPPollEvent;
+
+typedef struct _HTTPPollWatch
+{
+    SOCKET sock;
+    void *context;
+} HTTPPollWatch;
+
+typedef struct _HTTPPoller
+{
+#if HTTP_USE_EPOLL
+    int epfd;
+#else
+    SOCKET _max_sock;
+    fd_set _read_sock_pool;
+    fd_set _write_sock_pool;
+    int _watch_count;
+    HTTPPollWatch _watch[MAX_HTTP_CLIENT + 1];
+#endif
+} HTTPPoller;
+
+int HTTPPollerInit(HTTPPoller *);
+void HTTPPollerClose(HTTPPoller *);
+// Start watching a socket. 'context' is handed back with every event for it.
+int HTTPPollerAdd(HTTPPoller *, SOCKET, void *context, int events);
+// Change the interest set (HTTP_POLL_READ / HTTP_POLL_WRITE / 0) of a watched socket.
+// The edge-triggered backend always watches both directions, so this is a no-op there.
+void HTTPPollerModify(HTTPPoller *, SOCKET, int events);
+void HTTPPollerRemove(HTTPPoller *, SOCKET);
+// Wait at most timeout_ms for activity. Returns the number of events stored, 0 on
+// timeout, or < 0 when the wait failed (e.g. interrupted by a signal).
+int HTTPPollerWait(HTTPPoller *, HTTPPollEvent *events, int max, int timeout_ms);
+
+#endif
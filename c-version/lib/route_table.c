@@ -0,0 +1,321 @@
+#include "route_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUTE_METHODS (HTTP_PATCH + 1)
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ROUTE_NOINLINE __attribute__((noinline))
+#else
+#define ROUTE_NOINLINE
+#endif
+
+typedef struct _RouteNode
+{
+    char *prefix;                // literal text of the edge into this node
+    size_t prefix_len;
+    char *name;                  // name of a capture node
+    struct _RouteNode *children; // literal edges, each starting with another character
+    struct _RouteNode *next;     // sibling
+    struct _RouteNode *segment;  // {name}
+    struct _RouteNode *rest;     // {name*}
+    ROUTE_HANDLER handlers[ROUTE_METHODS];
+    void *contexts[ROUTE_METHODS];
+} RouteNode;
+
+/* Captures collected during the walk, as slices of the uri. */
+typedef struct {
+    const char *value[ROUTE_MAX_PARAMS];
+    size_t length[ROUTE_MAX_PARAMS];
+    const char *name[ROUTE_MAX_PARAMS];
+    size_t count;
+    const char *querystring; // past the '?', or the empty end of the uri
+} RouteCaptures;
+
+static RouteNode _root;
+
+static RouteNode *_NewNode(const char *text, size_t len)
+{
+    RouteNode *node = (RouteNode *)calloc(1, sizeof(RouteNode));
+    if (!node)
+        return NULL;
+    node->prefix = (char *)malloc(len + 1);
+    if (!node->prefix) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->prefix, text, len);
+    node->prefix[len] = 0;
+    node->prefix_len = len;
+    return node;
+}
+
+/* Follow or create the literal edges for text below node. */
+static RouteNode *_AddLiteral(RouteNode *node, const char *text, size_t len)
+{
+    while (len > 0) {
+        RouteNode *child = node->children;
+        size_t common = 0;
+
+        while (child && (child->prefix[0] != text[0]))
+            child = child->next;
+        if (!child) {
+            child = _NewNode(text, len);
+            if (!child)
+                return NULL;
+            child->next = node->children;
+            node->children = child;
+            return child;
+        }
+        while ((common < child->prefix_len) && (common < len) && (child->prefix[common] == text[common]))
+            common++;
+        if (common < child->prefix_len) {
+            // split the edge: the tail takes over everything below child
+            RouteNode *tail = _NewNode(child->prefix + common, child->prefix_len - common);
+            if (!tail)
+                return NULL;
+            tail->children = child->children;
+            tail->segment = child->segment;
+            tail->rest = child->rest;
+            memcpy(tail->handlers, child->handlers, sizeof(tail->handlers));
+            memcpy(tail->contexts, child->contexts, sizeof(tail->contexts));
+            child->children = tail;
+            child->segment = child->rest = NULL;
+            memset(child->handlers, 0, sizeof(child->handlers));
+            memset(child->contexts, 0, sizeof(child->contexts));
+            child->prefix_len = common;
+            child->prefix[common] = 0;
+        }
+        node = child;
+        text += common;
+        len -= common;
+    }
+    return node;
+}
+
+static RouteNode *_AddCapture(RouteNode **slot, const char *name, size_t len)
+{
+    RouteNode *node = *slot;
+
+    if (node)
+        return ((strlen(node->name) == len) && !strncmp(node->name, name, len)) ? node : NULL;
+    node = _NewNode("", 0);
+    if (!node)
+        return NULL;
+    node->name = (char *)malloc(len + 1);
+    if (!node->name) {
+        free(node->prefix);
+        free(node);
+        return NULL;
+    }
+    memcpy(node->name, name, len);
+    node->name[len] = 0;
+    *slot = node;
+    return node;
+}
+
+int RouteTableAdd(HTTPMethod method, const char *pattern, ROUTE_HANDLER handler, void *context)
+{
+    RouteNode *node = &_root;
+    const char *p = pattern;
+    int captures = 0;
+
+    if ((method >= ROUTE_METHODS) || !handler)
+        return -1;
+    if (*p == '/')
+        p++;
+    while (node && *p) {
+        if (*p == '{') {
+            const char *end = strchr(p, '}');
+            size_t len;
+            if (!end || (end == p + 1) || (++captures > ROUTE_MAX_PARAMS))
+                return -1;
+            len = end - p - 1;
+            if (p[len] == '*') {
+                if ((len == 1) || ((end[1] != 0) && (end[1] != ':')))
+                    return -1; // the rest of the path can only be followed by a command
+                node = _AddCapture(&(node->rest), p + 1, len - 1);
+            } else {
+                if (end[1] == '{')
+                    return -1; // two captures in a row cannot be told apart
+                node = _AddCapture(&(node->segment), p + 1, len);
+            }
+            p = end + 1;
+        } else {
+            size_t len = strcspn(p, "{");
+            node = _AddLiteral(node, p, len);
+            p += len;
+        }
+    }
+    if (!node || node->handlers[method])
+        return -1;
+    node->handlers[method] = handler;
+    node->contexts[method] = context;
+    return 0;
+}
+
+static RouteNode *_Walk(RouteNode *node, const char *s, const char *end, HTTPMethod method, RouteCaptures *cap);
+
+static RouteNode *_WalkCapture(RouteNode *node, const char *s, const char *e, const char *end, HTTPMethod method, RouteCaptures *cap)
+{
+    RouteNode *found;
+
+    cap->value[cap->count] = s;
+    cap->length[cap->count] = e - s;
+    cap->name[cap->count] = node->name;
+    cap->count++;
+    found = _Walk(node, e, end, method, cap);
+    if (!found)
+        cap->count--;
+    return found;
+}
+
+/* Match s..end below node, whose own edge is consumed. */
+static RouteNode *_Walk(RouteNode *node, const char *s, const char *end, HTTPMethod method, RouteCaptures *cap)
+{
+    RouteNode *child, *found;
+    const char *e;
+
+    if (s == end)
+        return (node->handlers[method] || node->handlers[HTTP_UNKNOWN]) ? node : NULL;
+
+    for (child = node->children; child; child = child->next) {
+        if (child->prefix[0] == *s) {
+            if (((size_t)(end - s) >= child->prefix_len) && !memcmp(child->prefix, s, child->prefix_len)) {
+                found = _Walk(child, s + child->prefix_len, end, method, cap);
+                if (found)
+                    return found;
+            }
+            break;
+        }
+    }
+    if (node->segment) {
+        for (e = s; (e < end) && (*e != '/') && (*e != ':'); e++)
+            ;
+        if ((e > s) && (found = _WalkCapture(node->segment, s, e, end, method, cap)))
+            return found;
+    }
+    if (node->rest) {
+        for (e = s + 1; e < end; e++) {
+            if ((*e == ':') && (found = _WalkCapture(node->rest, s, e, end, method, cap)))
+                return found;
+        }
+        return _WalkCapture(node->rest, s, end, end, method, cap);
+    }
+    return NULL;
+}
+
+static RouteNode *_Match(HTTPMethod method, const char *uri, RouteCaptures *cap)
+{
+    const char *end;
+
+    if (method >= ROUTE_METHODS)
+        return NULL;
+    if (*uri == '/')
+        uri++;
+    end = uri + strcspn(uri, "?");
+    cap->count = 0;
+    cap->querystring = (*end == '?') ? end + 1 : end;
+    return _Walk(&_root, uri, end, method, cap);
+}
+
+/* Copy the captures and the querystring of the route found by _Match() into
+   the arena. */
+static ROUTE_HANDLER _Fill(RouteNode *node, HTTPMethod method, RouteCaptures *cap, UrlArena *arena, RouteMatch *match)
+{
+    static const char *empty = "";
+    ROUTE_HANDLER handler = node->handlers[method];
+
+    match->context = node->contexts[method];
+    if (!handler) {
+        handler = node->handlers[HTTP_UNKNOWN];
+        match->context = node->contexts[HTTP_UNKNOWN];
+    }
+    match->arena = arena;
+    match->params_len = cap->count;
+    for (size_t i = 0; i < cap->count; i++) {
+        char *value = (char *)arena->base + arena->used;
+        if (arena->used + cap->length[i] + 1 > arena->size)
+            return NULL;
+        memcpy(value, cap->value[i], cap->length[i]);
+        value[cap->length[i]] = 0;
+        url_decode(value, value, 0);
+        arena->used += strlen(value) + 1;
+        match->params[i].name = cap->name[i];
+        match->params[i].value = value;
+        match->params[i].encoded = 0;
+    }
+
+    match->url.method = method;
+    match->url.apiversion = match->url.route = match->url.path = match->url.command = empty;
+    match->url.url_copy = NULL;
+    if (parse_querystring_arena(cap->querystring, &(match->url), arena))
+        return NULL;
+    return handler;
+}
+
+ROUTE_HANDLER RouteTableFind(HTTPMethod method, const char *uri, UrlArena *arena, RouteMatch *match)
+{
+    RouteCaptures cap;
+    RouteNode *node = _Match(method, uri, &cap);
+
+    return node ? _Fill(node, method, &cap, arena, match) : NULL;
+}
+
+const char *RouteTableParam(RouteMatch *match, const char *name)
+{
+    for (size_t i = 0; i < match->params_len; i++) {
+        if (!strcmp(match->params[i].name, name))
+            return match->params[i].value;
+    }
+    return NULL;
+}
+
+/* Out of line, so that the arena only takes stack space once a route matched. */
+static int ROUTE_NOINLINE _Run(RouteNode *node, RouteCaptures *cap, HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    char buffer[ROUTE_ARENA_SIZE];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    RouteMatch match;
+    ROUTE_HANDLER handler = _Fill(node, req->Header.Method, cap, &arena, &match);
+
+    if (!handler) {
+        res->KeepAlive = req->KeepAlive;
+        res->_index = sprintf((char *)res->_buf, "HTTP/1.1 414 URI Too Long\r\nConnection: %s\r\n"
+            "Content-Length: 0\r\n\r\n", HTTPConnectionValue(res));
+        return 0;
+    }
+    handler(&match, req, res);
+    return 0;
+}
+
+int RouteTableDispatch(HTTPReqMessage *req, HTTPRespMessage *res)
+{
+    RouteCaptures cap;
+    RouteNode *node = _Match(req->Header.Method, req->Header.URI, &cap);
+
+    return node ? _Run(node, &cap, req, res) : -1;
+}
+
+static void _Free(RouteNode *node)
+{
+    while (node) {
+        RouteNode *next = node->next;
+        _Free(node->children);
+        _Free(node->segment);
+        _Free(node->rest);
+        free(node->prefix);
+        free(node->name);
+        free(node);
+        node = next;
+    }
+}
+
+void RouteTableClear(void)
+{
+    _Free(_root.children);
+    _Free(_root.segment);
+    _Free(_root.rest);
+    memset(&_root, 0, sizeof(_root));
+}
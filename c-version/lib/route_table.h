@@ -0,0 +1,71 @@
+#ifndef __MICRO_HTTP_ROUTE_TABLE_H__
+#define __MICRO_HTTP_ROUTE_TABLE_H__
+
+#include "server.h"
+#include "url.h"
+
+/* Route table: the API endpoints are registered at startup and compiled into
+   a radix trie over the url path, so that finding the handler of a request is
+   one walk over its path, however many endpoints there are.
+
+   A pattern is the url path of an endpoint, e.g. "/v1/drives/{drive}:mount".
+   Next to literal text it may contain captures:
+     {name}   one path segment: stops at the next '/' or ':'
+     {name*}  the rest of the path, '/' included: stops at a ':' that the
+              pattern continues with (the command), or at the end
+   At any point, literal text is tried first, then a segment capture, then a
+   rest capture. Captured values are url decoded. Routes must be added before
+   the server runs; the table is read-only while serving. */
+
+// Captures per pattern.
+#ifndef ROUTE_MAX_PARAMS
+#define ROUTE_MAX_PARAMS 8
+#endif
+// Bytes of stack that RouteTableDispatch() copies the captures, the
+// querystring and its parameters of a matched url into. A url that does not
+// fit is answered with 414 URI Too Long.
+#ifndef ROUTE_ARENA_SIZE
+#if LWIP == 1
+#define ROUTE_ARENA_SIZE 512
+#else
+#define ROUTE_ARENA_SIZE 1024
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    struct Parameter params[ROUTE_MAX_PARAMS]; // captures, in pattern order
+    size_t params_len;
+    void *context;        // as given to RouteTableAdd()
+    UrlArena *arena;      // holds the captured values; has room left for the handler
+    UrlComponents url;    // method, querystring and parameters of the request; the
+                          // handler fills in the other fields from the captures
+} RouteMatch;
+
+typedef void (*ROUTE_HANDLER)(RouteMatch *match, HTTPReqMessage *req, HTTPRespMessage *res);
+
+/* Register handler for method (HTTP_UNKNOWN: any method) on pattern. Returns
+   -1 for a malformed pattern, or when the route is already taken. */
+int RouteTableAdd(HTTPMethod method, const char *pattern, ROUTE_HANDLER handler, void *context);
+
+/* Find the route of the url path uri. Returns the handler, with the captures
+   and the querystring parameters in match, or NULL. */
+ROUTE_HANDLER RouteTableFind(HTTPMethod method, const char *uri, UrlArena *arena, RouteMatch *match);
+
+/* Value of the capture name, or NULL when the route has no such capture. */
+const char *RouteTableParam(RouteMatch *match, const char *name);
+
+/* Run the handler of the request. The arena is only set up once a route
+   matches. Returns -1 when no route matches. */
+int RouteTableDispatch(HTTPReqMessage *req, HTTPRespMessage *res);
+
+/* Remove all routes. */
+void RouteTableClear(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,6 +8,12 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/socket.h>
+#if LWIP == 0
+#include <sys/uio.h>
+#endif
+#if HTTP_USE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 #if LWIP == 1
 #include "lwip/sys.h"
 #else
@@ -19,17 +25,14 @@
 #define IsReqWriteEnd(s) (s == WRITEEND_SOCKET)
 #define IsReqClose(s) (s == CLOSE_SOCKET)
 
-typedef struct _HTTPReq
+typedef struct _HTTPSlab
 {
-    SOCKET clisock;
-    HTTPReqMessage req;
-    HTTPRespMessage res;
-    size_t windex;
-    uint8_t work_state;
-    uint32_t last_active_ms;
-} HTTPReq;
-
-HTTPReq http_req[MAX_HTTP_CLIENT];
+    struct _HTTPSlab *next; // in the list of slabs with free connections
+    struct _HTTPSlab *prev;
+    HTTPReq *free;
+    int used;
+    HTTPReq slots[HTTP_POOL_SLAB_SIZE];
+} HTTPSlab;
 
 /* Millisecond clock used for per-connection idle timing. */
 static uint32_t _now_ms(void)
@@ -41,13 +44,12 @@ static uint32_t _now_ms(void)
 #endif
 }
 
-void HTTPServerInit(HTTPServer *srv, uint16_t port)
+static void _HTTPServerInit(HTTPServer *srv, uint16_t port, int reuseport)
 {
     // Just in case it was not initialized properly in BSS
     memset(srv, 0, sizeof(HTTPServer));
 
     struct sockaddr_in srv_addr;
-    unsigned int i;
 
     /* Have a server socket. */
     srv->sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -55,6 +57,11 @@ void HTTPServerInit(HTTPServer *srv, uint16_t port)
         DebugMsg("HTTPServerInit failed: no socket.\n");
         return;
     }
+    if (HTTPPollerInit(&(srv->poller)) < 0) {
+        DebugMsg("HTTPServerInit failed: no poller.\n");
+        HTTPServerClose(srv);
+        return;
+    }
     /* Set server address. */
     memset(&srv_addr, 0, sizeof(srv_addr));
     srv_addr.sin_family = AF_INET;
@@ -62,6 +69,12 @@ void HTTPServerInit(HTTPServer *srv, uint16_t port)
     srv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     /* Set the server socket can reuse the address. */
     setsockopt(srv->sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+#ifdef SO_REUSEPORT
+    /* Let the kernel balance incoming connections over all worker sockets. */
+    if (reuseport) {
+        setsockopt(srv->sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int));
+    }
+#endif
     /* Bind the server socket with the server address. */
     if (bind(srv->sock, (struct sockaddr *)&srv_addr, sizeof(srv_addr)) == -1) {
         HTTPServerClose(srv);
@@ -73,215 +86,648 @@ void HTTPServerInit(HTTPServer *srv, uint16_t port)
 
     /* Start server socket listening. */
     DebugMsg("Listening\n");
-    listen(srv->sock, MAX_HTTP_CLIENT / 2);
-
-    /* Append server socket to the master socket queue. */
-    FD_ZERO(&(srv->_read_sock_pool));
-    FD_ZERO(&(srv->_write_sock_pool));
-    FD_SET(srv->sock, &(srv->_read_sock_pool));
-    /* The server socket's FD is max in the master socket queue for now. */
-    srv->_max_sock = srv->sock;
+    listen(srv->sock, HTTP_LISTEN_BACKLOG);
 
-    /* Prepare the HTTP client requests pool. */
-    for (i = 0; i < MAX_HTTP_CLIENT; i++) {
-        http_req[i].clisock = -1;
-        http_req[i].work_state = NOTWORK_SOCKET;
+    /* Append server socket to the poller. Its context is NULL, which is how
+       HTTPServerRun tells it apart from the client connections. */
+    if (HTTPPollerAdd(&(srv->poller), srv->sock, NULL, HTTP_POLL_READ) < 0) {
+        DebugMsg("HTTPServerInit failed: no poller.\n");
+        HTTPServerClose(srv);
+        return;
     }
+
+    /* The HTTP client requests pool starts empty and grows on demand. */
+    srv->max_connections = MAX_HTTP_CLIENT;
     srv->available_connections = MAX_HTTP_CLIENT;
+    srv->last_reap_ms = _now_ms();
+}
+
+static void _SlabLink(HTTPSlab **list, HTTPSlab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void _SlabUnlink(HTTPSlab **list, HTTPSlab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/* Take a free connection from the pool in O(1), allocating a new slab only
+   when all slabs are in use. */
+static HTTPReq *_PoolAcquire(HTTPServer *srv)
+{
+    HTTPSlab *slab = srv->partial;
+    HTTPReq *hr;
+    int i;
+
+    if (!slab) {
+        slab = srv->spare;
+        srv->spare = NULL;
+        if (!slab) {
+            slab = (HTTPSlab *)malloc(sizeof(HTTPSlab));
+            if (!slab)
+                return NULL;
+            slab->free = NULL;
+            slab->used = 0;
+            for (i = HTTP_POOL_SLAB_SIZE - 1; i >= 0; i--) {
+                slab->slots[i]._slab = slab;
+                slab->slots[i]._next = slab->free;
+                slab->free = slab->slots + i;
+            }
+        }
+        _SlabLink(&(srv->partial), slab);
+    }
+    hr = slab->free;
+    slab->free = hr->_next;
+    if (++slab->used == HTTP_POOL_SLAB_SIZE)
+        _SlabUnlink(&(srv->partial), slab);
+
+    hr->_prev = NULL;
+    hr->_next = srv->active;
+    if (srv->active)
+        srv->active->_prev = hr;
+    srv->active = hr;
+    return hr;
+}
+
+static void _PoolRelease(HTTPServer *srv, HTTPReq *hr)
+{
+    HTTPSlab *slab = hr->_slab;
+
+    if (hr->_prev)
+        hr->_prev->_next = hr->_next;
+    else
+        srv->active = hr->_next;
+    if (hr->_next)
+        hr->_next->_prev = hr->_prev;
+
+    if (slab->used == HTTP_POOL_SLAB_SIZE)
+        _SlabLink(&(srv->partial), slab);
+    hr->_next = slab->free;
+    slab->free = hr;
+    if (--slab->used == 0) {
+        _SlabUnlink(&(srv->partial), slab);
+        if (srv->spare) {
+            free(slab);
+        } else {
+            srv->spare = slab;
+        }
+    }
+}
+
+/* Give the connection its request and response buffers, when it has none. */
+static int _AttachIO(HTTPServer *srv, HTTPReq *hr)
+{
+    HTTPConnIO *io = srv->spare_io;
+    void *multipart = NULL;
+
+    if (hr->io)
+        return 0;
+    if (io) {
+        srv->spare_io = io->_next;
+        srv->spare_io_count--;
+        multipart = io->req._multipart; // the spare buffers keep their parser
+    } else {
+        io = (HTTPConnIO *)malloc(sizeof(HTTPConnIO));
+        if (!io)
+            return -1;
+    }
+    InitReqMessage(&(io->req));
+    InitRespMessage(&(io->res));
+    io->req._requests = hr->_requests;
+    io->req._multipart = multipart;
+    hr->io = io;
+    return 0;
+}
+
+static void _DetachIO(HTTPServer *srv, HTTPReq *hr)
+{
+    HTTPConnIO *io = hr->io;
+
+    if (!io)
+        return;
+    hr->_requests = io->req._requests;
+    hr->io = NULL;
+    if (srv->spare_io_count < HTTP_POOL_SPARE_IO) {
+        io->_next = srv->spare_io;
+        srv->spare_io = io;
+        srv->spare_io_count++;
+    } else {
+        ReleaseReqMessage(&(io->req));
+        free(io);
+    }
+}
+
+/* Between requests, with nothing received of the next one: the buffers
+   hold no state, so the connection can do without them. */
+static int _IsIdle(HTTPReq *hr)
+{
+    HTTPReqMessage *req = &(hr->io->req);
+
+    return (hr->work_state == READING_SOCKET) && (req->protocol_state == eReq_Header) &&
+        (req->_valid == 0) && (req->Header._buffer_valid == 0);
+}
+
+void HTTPServerInit(HTTPServer *srv, uint16_t port)
+{
+    _HTTPServerInit(srv, port, 0);
+}
+
+void HTTPServerInitReusePort(HTTPServer *srv, uint16_t port)
+{
+    _HTTPServerInit(srv, port, 1);
 }
 
 void _HTTPServerAccept(HTTPServer *srv)
 {
     struct sockaddr_in cli_addr;
-    socklen_t sockaddr_len = sizeof(cli_addr);
+    socklen_t sockaddr_len;
     SOCKET clisock;
-    unsigned int i;
-
-    /* Have the client socket and append it to the master socket queue. */
-    clisock = accept(srv->sock, (struct sockaddr *)&cli_addr, &sockaddr_len);
-    if (clisock != -1) {
-        FD_SET(clisock, &(srv->_read_sock_pool));
-        /* Set the client socket non-blocking. */
-        // fcntl(clisock, F_SETFL, O_NONBLOCK);
-        /* Set the max socket file descriptor. */
-        if (clisock > srv->_max_sock)
-            srv->_max_sock = clisock;
+    HTTPReq *hr;
+
+    /* The edge-triggered poller reports a pending connection only once, so all
+       of them are accepted now; select() simply reports the socket again. */
+    do {
+        if (srv->available_connections <= 0) {
+            /* Pool is full: stop watching the server socket until a client slot
+               is released (see _HTTPServerCloseClient). */
+            HTTPPollerModify(&(srv->poller), srv->sock, 0);
+            srv->accept_paused = 1;
+            return;
+        }
+        /* Have the client socket and add it to the poller. */
+        sockaddr_len = sizeof(cli_addr);
+        clisock = accept(srv->sock, (struct sockaddr *)&cli_addr, &sockaddr_len);
+        if (clisock == -1) {
+            return;
+        }
+        /* Set the client socket non-blocking. recv() and send() pass MSG_DONTWAIT,
+           but sendfile() has no such flag. */
+#if HTTP_USE_SENDFILE
+        fcntl(clisock, F_SETFL, O_NONBLOCK);
+#endif
         /* Add into HTTP client requests pool. */
-        for (i = 0; i < MAX_HTTP_CLIENT; i++) {
-            if (http_req[i].clisock == -1) {
-                DebugMsg("Accept client %d on socket %d.  %s:%d\n", i, clisock, 
-                    inet_ntoa(cli_addr.sin_addr), (int)ntohs(cli_addr.sin_port));
-                srv->available_connections -= 1;
-                if (srv->available_connections == 0) {
-                    FD_CLR(srv->sock, &(srv->_read_sock_pool));
-                }
-                InitReqMessage(&(http_req[i].req));
-                http_req[i].clisock = clisock;
-                http_req[i].res.Header.FieldCount = 0;
-                http_req[i].windex = 0;
-                http_req[i].work_state = READING_SOCKET;
-                http_req[i].last_active_ms = _now_ms();
-                break;
-            }
+        hr = _PoolAcquire(srv);
+        if (!hr || (HTTPPollerAdd(&(srv->poller), clisock, hr, HTTP_POLL_READ) < 0)) {
+            if (hr)
+                _PoolRelease(srv, hr);
+            close(clisock);
+            return;
+        }
+        uint32_t addr = ntohl(cli_addr.sin_addr.s_addr); // inet_ntoa() is not thread-safe
+        DebugMsg("Accept client on socket %d.  %u.%u.%u.%u:%d\n", clisock,
+            (unsigned)(addr >> 24), (unsigned)(addr >> 16) & 0xFF, (unsigned)(addr >> 8) & 0xFF,
+            (unsigned)addr & 0xFF, (int)ntohs(cli_addr.sin_port));
+        srv->available_connections -= 1;
+        hr->io = NULL; // attached when the first request arrives
+        hr->_requests = 0;
+        hr->clisock = clisock;
+        hr->windex = 0;
+        hr->work_state = READING_SOCKET;
+        hr->last_active_ms = _now_ms();
+    } while (HTTP_POLLER_EDGE);
+}
+
+static void _HTTPServerResumeAccept(HTTPServer *srv)
+{
+    if (srv->accept_paused && (srv->available_connections > 0)) {
+        // at least one free socket, so accept is now allowed
+        srv->accept_paused = 0;
+        HTTPPollerModify(&(srv->poller), srv->sock, HTTP_POLL_READ);
+        /* Connections that queued up while the pool was full will not raise a
+           new edge on the server socket, so pick them up right away. */
+        if (HTTP_POLLER_EDGE) {
+            _HTTPServerAccept(srv);
         }
     }
 }
 
+void HTTPServerSetMaxConnections(HTTPServer *srv, int max)
+{
+#if !HTTP_USE_EPOLL
+    if (max > MAX_HTTP_CLIENT)
+        max = MAX_HTTP_CLIENT; // the select() watch list has a fixed size
+#endif
+    srv->available_connections += max - srv->max_connections;
+    srv->max_connections = max;
+    _HTTPServerResumeAccept(srv);
+}
+
 int ReadSock(HTTPReq *hr)
 {
     SOCKET clisock = hr->clisock;
-    HTTPReqMessage *req = &(hr->req);
+    HTTPReqMessage *req = &(hr->io->req);
     char *p = (char *)req->_buf;
     p += req->_valid;
     int space = HTTP_BUFFER_SIZE - req->_valid;
     //printf("Recv %d -> %p\n", space, p);
-    int n = space ? recv(clisock, p, space, 0) : 0;
+    int n = space ? recv(clisock, p, space, MSG_DONTWAIT) : 0;
     if (n >= 0) {
         req->_valid += n;
     }
     return n;
 }
 
-void WriteSock(HTTPReq *hr)
+static void _ReleaseBodyData(HTTPRespMessage *res)
 {
-    ssize_t n;
+    if (res->BodyRelease) {
+        res->BodyRelease(res->BodyContext);
+        res->BodyRelease = NULL;
+    }
+    res->BodyData = NULL;
+    res->BodyDataLength = 0;
+}
 
-    if ((hr->windex >= hr->res._index) && (hr->res.BodyCB)) {
-        hr->windex = 0;
-        hr->res._index = hr->res.BodyCB(hr->res.BodyContext, hr->res._buf, HTTP_BUFFER_SIZE);
-        if (hr->res._index == 0) {
-            hr->res.BodyCB = NULL;
-        }
+/* Anything left to send from _buf, the queued segments or BodyData. */
+static int _HasVectorData(HTTPReq *hr)
+{
+    HTTPRespMessage *res = &(hr->io->res);
+
+    return (hr->windex < res->_index) || (res->_segment_sent < res->_segment_count) || (res->BodyData != NULL);
+}
+
+/* Send pieces[0 .. count) in one go. Returns what send() returns. */
+static ssize_t _SendPieces(SOCKET sock, const HTTPRespSegment *pieces, int count)
+{
+#if LWIP == 1
+    /* lwIP has no portable scatter-gather send: one piece per call, the rest
+       goes out on the next ones. lwIP does not raise SIGPIPE. */
+    (void)count;
+    return send(sock, pieces[0].data, pieces[0].length, MSG_DONTWAIT);
+#else
+    /* A writev() that does not raise SIGPIPE. */
+    struct iovec iov[HTTP_RESP_SEGMENTS + 2];
+    struct msghdr msg;
+
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = (void *)pieces[i].data;
+        iov[i].iov_len = pieces[i].length;
     }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+#endif
+}
 
-    n = send(hr->clisock, hr->res._buf + hr->windex, hr->res._index - hr->windex, MSG_DONTWAIT);
-    if (n > 0) {
-        /* Send some bytes and send left next loop. */
-        hr->windex += n;
-        if ((hr->res._index > hr->windex) || (hr->res.BodyCB))
+/* Send the rest of _buf, the queued segments and an in-memory body (e.g. a
+   cached static file) from where they are, gathered into one send. */
+static ssize_t _WriteSockVector(HTTPReq *hr)
+{
+    HTTPRespMessage *res = &(hr->io->res);
+    HTTPRespSegment pieces[HTTP_RESP_SEGMENTS + 2];
+    int count = 0;
+    ssize_t n = 0;
+    size_t left;
+
+    if (hr->windex < res->_index) {
+        pieces[count].data = res->_buf + hr->windex;
+        pieces[count++].length = res->_index - hr->windex;
+    }
+    for (int i = res->_segment_sent; i < res->_segment_count; i++) {
+        pieces[count++] = res->_segments[i];
+    }
+    if (res->BodyDataLength > 0) {
+        pieces[count].data = res->BodyData;
+        pieces[count++].length = res->BodyDataLength;
+    }
+    if (count > 0) {
+        n = _SendPieces(hr->clisock, pieces, count);
+    }
+    if (n < 0) {
+        /* Nothing was sent. When the stack reports that the socket would
+           block (its send buffer is full), the same bytes are retried once it
+           is writable again; any other error ends the connection. */
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
             hr->work_state = WRITING_SOCKET;
         else
-            hr->work_state = WRITEEND_SOCKET;
-    } else if (n == 0) {
-        /* Writing is finished. */
+            hr->work_state = CLOSE_SOCKET;
+        return n;
+    }
+
+    /* Take what was sent off the front of the vector. */
+    left = (size_t)n;
+    if (hr->windex < res->_index) {
+        size_t c = res->_index - hr->windex;
+        if (c > left)
+            c = left;
+        hr->windex += c;
+        left -= c;
+    }
+    while ((left > 0) && (res->_segment_sent < res->_segment_count)) {
+        HTTPRespSegment *segment = res->_segments + res->_segment_sent;
+        if (left >= segment->length) {
+            left -= segment->length;
+            res->_segment_sent++;
+        } else {
+            segment->data += left;
+            segment->length -= left;
+            left = 0;
+        }
+    }
+    if (left > 0) {
+        res->BodyData += left;
+        res->BodyDataLength -= left;
+    }
+    if (res->BodyData && (res->BodyDataLength == 0) && (hr->windex >= res->_index) &&
+        (res->_segment_sent == res->_segment_count)) {
+        _ReleaseBodyData(res);
+    }
+
+    if (_HasVectorData(hr) || res->BodyCB)
+        hr->work_state = WRITING_SOCKET;
+#if HTTP_USE_SENDFILE
+    else if (res->BodyFd >= 0)
+        hr->work_state = WRITING_SOCKET;
+#endif
+    else
         hr->work_state = WRITEEND_SOCKET;
-    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-        /* Send buffer full on a non-blocking socket: nothing was sent, so leave
-           windex unchanged and retry the SAME bytes when the socket is writable
-           again. (Previously windex was advanced to res._index as if the buffer
-           had been sent, silently dropping the unsent tail and truncating large
-           responses to slow readers.) */
+    return n;
+}
+
+#if HTTP_USE_SENDFILE
+static void _CloseBodyFd(HTTPRespMessage *res)
+{
+    if (res->BodyFd >= 0) {
+        close(res->BodyFd);
+        res->BodyFd = -1;
+    }
+}
+
+/* Send the file body of a response, once the header in _buf is out. The data
+   goes from the page cache to the socket without being copied into _buf. */
+static ssize_t _WriteSockFile(HTTPReq *hr)
+{
+    HTTPRespMessage *res = &(hr->io->res);
+    ssize_t n = 0;
+
+    if (res->BodyLength > 0) {
+        n = sendfile(hr->clisock, res->BodyFd, &(res->BodyOffset), res->BodyLength);
+    }
+    if (n > 0) {
+        res->BodyLength -= n;
+    }
+    if ((n >= 0) && (res->BodyLength == 0)) {
+        _CloseBodyFd(res);
+        hr->work_state = WRITEEND_SOCKET;
+    } else if (n == 0) {
+        /* The file shrank after the header was sent: the announced length
+           can no longer be met, so the connection must be dropped. */
+        hr->work_state = CLOSE_SOCKET;
+    } else if ((n > 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
         hr->work_state = WRITING_SOCKET;
     } else {
-        /* Send with error. */
         hr->work_state = CLOSE_SOCKET;
     }
+    return n;
 }
+#endif
 
-void HTTPServerRun(HTTPServer *srv, HTTPREQ_CALLBACK callback)
+ssize_t WriteSock(HTTPReq *hr)
 {
-    fd_set readable, writeable;
-    struct timeval timeout = { HTTP_CONN_IDLE_TIMEOUT, 0 };
-    uint16_t i;
+    if (_HasVectorData(hr)) {
+        return _WriteSockVector(hr);
+    }
+#if HTTP_USE_SENDFILE
+    if (hr->io->res.BodyFd >= 0) {
+        return _WriteSockFile(hr);
+    }
+#endif
+    if (hr->io->res.BodyCB) {
+        hr->windex = 0;
+        hr->io->res._index = hr->io->res.BodyCB(hr->io->res.BodyContext, hr->io->res._buf, HTTP_BUFFER_SIZE);
+        if (hr->io->res._index == 0) {
+            hr->io->res.BodyCB = NULL;
+            _ReleaseBodyData(&(hr->io->res));
+        }
+    }
+    /* Also reports the end of the response when there is nothing left. */
+    return _WriteSockVector(hr);
+}
 
-    if (srv->sock < 0)
-        return;
+/* Returns 1 when c completes the empty line that ends a header. */
+static int _HeaderEnd(uint8_t c, int *matched)
+{
+    static const char crlf2[] = "\r\n\r\n";
 
-    /* Copy master socket queue to readable, writeable socket queue. */
-    readable = srv->_read_sock_pool;
-    writeable = srv->_write_sock_pool;
-    /* Wait for activity on any socket, but time out so idle/stuck client
-       connections can be reaped (see HTTP_CONN_IDLE_TIMEOUT). */
-    int nready = select(srv->_max_sock + 1, &readable, &writeable, NULL, &timeout);
-    if (nready < 0) {
-        /* select() failed (e.g. interrupted by a signal): the fd_sets are now
-           undefined, so do not inspect them this round. */
-        return;
+    *matched = (c == (uint8_t)crlf2[*matched]) ? *matched + 1 : (c == '\r');
+    return *matched == 4;
+}
+
+/* A response to HEAD is the header that GET would get, without the body
+   (RFC 9110, 9.3.2). Handlers build the GET response; the body is cut off
+   here, for all of them, so that a persistent connection stays in step. */
+static void _CutHeadBody(HTTPRespMessage *res)
+{
+    int matched = 0, i;
+    size_t k;
+
+    for (k = 0; k < res->_index; k++) {
+        if (_HeaderEnd(res->_buf[k], &matched)) {
+            res->_index = k + 1;
+            res->_segment_count = 0;
+            goto cut;
+        }
     }
-    uint32_t now = _now_ms();
-    /* Check server socket is readable. */
-    if (FD_ISSET(srv->sock, &readable) && (srv->available_connections > 0)) {
-        /* Accept when server socket has been connected. */
-        _HTTPServerAccept(srv);
-    }
-    /* Check sockets in HTTP client requests pool are readable. */
-    for (i = 0; i < MAX_HTTP_CLIENT; i++) {
-        if (http_req[i].clisock != -1) {
-            int active = 0;
-            if (FD_ISSET(http_req[i].clisock, &readable)) {
-                http_req[i].last_active_ms = now;
-                active = 1;
-                /* Deal the request from the client socket. */
+    for (i = 0; i < res->_segment_count; i++) {
+        for (k = 0; k < res->_segments[i].length; k++) {
+            if (_HeaderEnd(res->_segments[i].data[k], &matched)) {
+                res->_segments[i].length = k + 1;
+                res->_segment_count = i + 1;
+                goto cut;
+            }
+        }
+    }
+    return; // no complete header to cut after
+cut:
+    res->BodyCB = NULL;
+    _ReleaseBodyData(res);
+#if HTTP_USE_SENDFILE
+    _CloseBodyFd(res);
+#endif
+}
+
+/* Run the protocol on the received data, and prepare the response once it
+   is ready. */
+static uint8_t _ProcessClientData(HTTPReq *hr, HTTPREQ_CALLBACK callback)
+{
+    uint8_t state = ProcessClientData(&(hr->io->req), &(hr->io->res), callback);
+
+    if (IsReqWriting(state) && (hr->io->req.Header.Method == HTTP_HEAD))
+        _CutHeadBody(&(hr->io->res));
+    return state;
+}
+
+void _HTTPServerCloseClient(HTTPServer *srv, HTTPReq *hr)
+{
+    /* If a request body was still being absorbed when the connection
+       is torn down (client disconnect / idle reap mid-upload), tell
+       the absorber to abort (len < 0) so it releases its buffers,
+       open file handle and request context instead of leaking them.
+       A completed body already cleared BodyCB (see ProcessClientData),
+       so this is a no-op for normal, fully-received requests. */
+    if (hr->io) {
+        if (hr->io->req.BodyCB) {
+            hr->io->req.BodyCB(hr->io->req.BodyContext, NULL, -1);
+            hr->io->req.BodyCB = NULL;
+            hr->io->req.BodyContext = NULL;
+        }
+        _ReleaseBodyData(&(hr->io->res));
+#if HTTP_USE_SENDFILE
+        _CloseBodyFd(&(hr->io->res));
+#endif
+        _DetachIO(srv, hr);
+    }
+    HTTPPollerRemove(&(srv->poller), hr->clisock);
+    shutdown(hr->clisock, SHUT_RDWR);
+    close(hr->clisock);
+    hr->clisock = -1;
+    hr->work_state = NOTWORK_SOCKET;
+    _PoolRelease(srv, hr);
+    srv->available_connections += 1;
+    _HTTPServerResumeAccept(srv);
+}
+
+/* Run the connection state machine for one ready client. With select() a
+   single read or write is done per readiness report. With the edge-triggered
+   poller the socket is drained until it would block, because no further event
+   is raised for data that is already pending. */
+void _HTTPServerServe(HTTPServer *srv, HTTPReq *hr, int events, HTTPREQ_CALLBACK callback)
+{
+    while (1) {
+        if ((events & HTTP_POLL_READ) && (hr->work_state == READING_SOCKET)) {
+            if (_AttachIO(srv, hr) < 0) {
+                hr->work_state = CLOSE_SOCKET;
+                break;
+            }
+            do {
                 // ReadSock simply reads (the maximum amount of) data into the read buffer and returns
                 // a negative value if the socket errors out. In all other cases, the data is passed to
                 // the ProcessClientData function, which implements the HTTP protocol.
-                int rd = ReadSock(http_req + i);
+                int rd = ReadSock(hr);
                 if (rd > 0) {
                     // processing client data may cause the socket to switch to write mode, or close.
-                    http_req[i].work_state = ProcessClientData(&(http_req[i].req), &(http_req[i].res), callback);
+                    hr->work_state = _ProcessClientData(hr, callback);
+                } else if ((rd < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+                    break; // drained
                 } else {
                     /* recv() returned <= 0: < 0 is a socket error/reset, 0 is peer EOF.
                        Close the connection so its client slot is freed. Without this the
-                       slot leaks and the now-dead fd keeps waking select(), eventually
+                       slot leaks and the now-dead fd keeps waking the poller, eventually
                        driving available_connections to 0 and locking the server up. */
-                    http_req[i].work_state = CLOSE_SOCKET;
-                }
-                if (IsReqWriting(http_req[i].work_state)) {
-                    FD_SET(http_req[i].clisock, &(srv->_write_sock_pool));
-                    FD_CLR(http_req[i].clisock, &(srv->_read_sock_pool));
+                    hr->work_state = CLOSE_SOCKET;
                 }
+            } while (HTTP_POLLER_EDGE && (hr->work_state == READING_SOCKET));
+            if (_IsIdle(hr))
+                _DetachIO(srv, hr);
+
+            if (IsReqWriting(hr->work_state)) {
+                HTTPPollerModify(&(srv->poller), hr->clisock, HTTP_POLL_WRITE);
+                /* The response is ready now; an edge-triggered socket that is
+                   already writable will not report it again, so start sending. */
+                events |= HTTP_POLLER_EDGE ? HTTP_POLL_WRITE : 0;
             }
-            if (IsReqWriting(http_req[i].work_state) && FD_ISSET(http_req[i].clisock, &writeable)) {
-                http_req[i].last_active_ms = now;
-                active = 1;
-                WriteSock(http_req + i);
-            }
-            /* Per-connection idle reaper: a connection that has seen no read or
-               write activity for HTTP_CONN_IDLE_TIMEOUT seconds is stuck (e.g. a
-               slowloris client that opened a slot then went silent). Reap it to
-               free the slot, even while other connections stay busy. The signed
-               difference is wrap-safe and, importantly, stays negative for a
-               connection just accepted this round whose timestamp is a hair ahead
-               of 'now', so a fresh connection is never reaped on arrival. */
-            if (!active &&
-                (int32_t)(now - http_req[i].last_active_ms) >= (int32_t)(HTTP_CONN_IDLE_TIMEOUT * 1000)) {
-                http_req[i].work_state = CLOSE_SOCKET;
-            }
-            if (IsReqWriteEnd(http_req[i].work_state)) {
-                http_req[i].work_state = CLOSE_SOCKET;
-            }
-            if (IsReqClose(http_req[i].work_state)) {
-                /* If a request body was still being absorbed when the connection
-                   is torn down (client disconnect / idle reap mid-upload), tell
-                   the absorber to abort (len < 0) so it releases its buffers,
-                   open file handle and request context instead of leaking them.
-                   A completed body already cleared BodyCB (see ProcessClientData),
-                   so this is a no-op for normal, fully-received requests. */
-                if (http_req[i].req.BodyCB) {
-                    http_req[i].req.BodyCB(http_req[i].req.BodyContext, NULL, -1);
-                    http_req[i].req.BodyCB = NULL;
-                    http_req[i].req.BodyContext = NULL;
+        }
+        if (IsReqWriting(hr->work_state) && (events & HTTP_POLL_WRITE)) {
+            do {
+                if ((WriteSock(hr) < 0) && IsReqWriting(hr->work_state)) {
+                    break; // socket send buffer full, wait for the next event
+                }
+            } while (HTTP_POLLER_EDGE && IsReqWriting(hr->work_state));
+        }
+        if (IsReqWriteEnd(hr->work_state)) {
+            /* Persistent connection: when both the client and the application
+               agreed (the response is length-delimited), the slot is recycled
+               for the next request instead of being closed. */
+            if (hr->io->req.KeepAlive && hr->io->res.KeepAlive) {
+                ResetReqMessage(&(hr->io->req));
+                InitRespMessage(&(hr->io->res));
+                hr->windex = 0;
+                hr->work_state = READING_SOCKET;
+                /* Pipelining: a request that was received together with the previous
+                   one is already in the buffer. Handle it before reading more, so
+                   responses go out one at a time, in request order. */
+                if (hr->io->req._valid > 0) {
+                    hr->work_state = _ProcessClientData(hr, callback);
+                    if (IsReqWriting(hr->work_state)) {
+                        events = HTTP_POLL_WRITE; // the socket was writable a moment ago
+                        continue;
+                    }
                 }
-                shutdown(http_req[i].clisock, SHUT_RDWR);
-                close(http_req[i].clisock);
-                /* Remove the now-closed fd from BOTH master pools. Clearing only
-                   the write pool leaks the fd in the read pool for any connection
-                   closed straight from the reading state (e.g. a read error/reset,
-                   which never passes through the writing state where the read pool
-                   is cleared). A closed fd left in the read set makes select()
-                   return immediately every iteration, so the server busy-spins and
-                   starves the rest of the TCP/IP stack. */
-                FD_CLR(http_req[i].clisock, &(srv->_read_sock_pool));
-                FD_CLR(http_req[i].clisock, &(srv->_write_sock_pool));
-                if (http_req[i].clisock >= srv->_max_sock)
-                    srv->_max_sock -= 1;
-                http_req[i].clisock = -1;
-                http_req[i].work_state = NOTWORK_SOCKET;
-                srv->available_connections += 1;
-                // at least one free socket, so accept is now allowed
-                FD_SET(srv->sock, &(srv->_read_sock_pool));
+                if (_IsIdle(hr))
+                    _DetachIO(srv, hr);
+                HTTPPollerModify(&(srv->poller), hr->clisock, HTTP_POLL_READ);
+                /* With the edge-triggered poller, a request that arrived while the
+                   response was being written has already raised its edge. */
+                if (HTTP_POLLER_EDGE && (hr->work_state == READING_SOCKET)) {
+                    events = HTTP_POLL_READ;
+                    continue;
+                }
+            } else {
+                hr->work_state = CLOSE_SOCKET;
             }
         }
+        break;
+    }
+    if (IsReqClose(hr->work_state)) {
+        _HTTPServerCloseClient(srv, hr);
+    }
+}
+
+void HTTPServerRun(HTTPServer *srv, HTTPREQ_CALLBACK callback)
+{
+    HTTPPollEvent events[HTTP_POLL_EVENTS];
+    int i;
+
+    if (srv->sock < 0)
+        return;
+
+    /* Wait for activity on any socket, but time out so idle/stuck client
+       connections can be reaped (see HTTP_CONN_IDLE_TIMEOUT). */
+    int nready = HTTPPollerWait(&(srv->poller), events, HTTP_POLL_EVENTS, HTTP_CONN_IDLE_TIMEOUT * 1000);
+    if (nready < 0) {
+        return;
+    }
+    uint32_t now = _now_ms();
+    /* Only the sockets that are ready are visited. */
+    for (i = 0; i < nready; i++) {
+        HTTPReq *hr = (HTTPReq *)events[i].context;
+        if (hr == NULL) {
+            /* Accept when server socket has been connected. */
+            _HTTPServerAccept(srv);
+        } else if (hr->clisock != -1) {
+            hr->last_active_ms = now;
+            _HTTPServerServe(srv, hr, events[i].events, callback);
+        }
+    }
+    /* Per-connection idle reaper: a connection that has seen no read or
+       write activity for HTTP_CONN_IDLE_TIMEOUT seconds is stuck (e.g. a
+       slowloris client that opened a slot then went silent). Reap it to
+       free the slot, even while other connections stay busy. The pool is
+       only scanned once a second (or when the wait timed out), so a busy
+       server does not pay for the scan on every iteration. The signed
+       difference is wrap-safe and, importantly, stays negative for a
+       connection just accepted this round whose timestamp is a hair ahead
+       of 'now', so a fresh connection is never reaped on arrival. */
+    if ((nready == 0) || ((int32_t)(now - srv->last_reap_ms) >= 1000)) {
+        srv->last_reap_ms = now;
+        HTTPReq *hr = srv->active;
+        while (hr) {
+            HTTPReq *next = hr->_next; // hr may be released below
+            if ((int32_t)(now - hr->last_active_ms) >= (int32_t)(HTTP_CONN_IDLE_TIMEOUT * 1000)) {
+                _HTTPServerCloseClient(srv, hr);
+            }
+            hr = next;
+        }
     }
 }
 
@@ -289,7 +735,72 @@ void HTTPServerClose(HTTPServer *srv)
 {
     if (srv->sock < 0)
         return;
+    HTTPPollerClose(&(srv->poller));
     shutdown(srv->sock, SHUT_RDWR);
     close((srv)->sock);
     srv->sock = -1;
 }
+
+#if HTTP_WORKERS
+#include <pthread.h>
+
+typedef struct _HTTPWorker
+{
+    pthread_t thread;
+    int running;
+    HTTPREQ_CALLBACK callback;
+    HTTPServer srv;
+} HTTPWorker;
+
+static void *_HTTPWorkerMain(void *context)
+{
+    HTTPWorker *worker = (HTTPWorker *)context;
+
+    while (worker->srv.sock >= 0) {
+        HTTPServerRun(&(worker->srv), worker->callback);
+    }
+    return NULL;
+}
+
+int HTTPServerRunWorkers(uint16_t port, int workers, int max_connections, HTTPREQ_CALLBACK callback)
+{
+    HTTPWorker *pool;
+    int i, started = 0;
+
+    if (workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers <= 0)
+            workers = 1;
+    }
+    /* Each worker owns its server and connection pool; nothing is shared
+       between the threads but the port. */
+    pool = (HTTPWorker *)calloc(workers, sizeof(HTTPWorker));
+    if (!pool) {
+        return -1;
+    }
+    for (i = 0; i < workers; i++) {
+        pool[i].callback = callback;
+        HTTPServerInitReusePort(&(pool[i].srv), port);
+        if (pool[i].srv.sock < 0) {
+            continue;
+        }
+        if (max_connections > 0) {
+            HTTPServerSetMaxConnections(&(pool[i].srv), max_connections);
+        }
+        if (pthread_create(&(pool[i].thread), NULL, _HTTPWorkerMain, pool + i) != 0) {
+            HTTPServerClose(&(pool[i].srv));
+            continue;
+        }
+        pool[i].running = 1;
+        started++;
+    }
+    DebugMsg("Started %d of %d workers\n", started, workers);
+    for (i = 0; i < workers; i++) {
+        if (pool[i].running) {
+            pthread_join(pool[i].thread, NULL);
+        }
+    }
+    free(pool);
+    return started ? 0 : -1;
+}
+#endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #ifdef RUNS_ON_PC
     #include <sys/select.h>
@@ -20,9 +21,37 @@
 #define LWIP 0
 #endif
 
+/* Default upper bound of simultaneous client connections. It can be changed at
+   run time with HTTPServerSetMaxConnections(); the select() backend cannot go
+   beyond this compile-time value. */
 #ifndef MAX_HTTP_CLIENT
 #define MAX_HTTP_CLIENT 4
 #endif
+/* Client connections are allocated on demand, this many at a time (a slab).
+   Free connections are reused in O(1); a slab that becomes completely free is
+   returned to the heap, except for one that is kept to absorb fluctuations. */
+#ifndef HTTP_POOL_SLAB_SIZE
+#if LWIP == 1
+#define HTTP_POOL_SLAB_SIZE MAX_HTTP_CLIENT
+#else
+#define HTTP_POOL_SLAB_SIZE 16
+#endif
+#endif
+/* I/O buffers given back by idle connections that are kept for the next
+   request, instead of being returned to the heap. */
+#ifndef HTTP_POOL_SPARE_IO
+#define HTTP_POOL_SPARE_IO 4
+#endif
+/* Length of the kernel queue of connections waiting to be accepted. Now that
+   the pool is sized at run time it is no longer derived from MAX_HTTP_CLIENT,
+   except on lwIP where every queued connection costs a PCB. */
+#ifndef HTTP_LISTEN_BACKLOG
+#if LWIP == 1
+#define HTTP_LISTEN_BACKLOG (MAX_HTTP_CLIENT / 2)
+#else
+#define HTTP_LISTEN_BACKLOG SOMAXCONN
+#endif
+#endif
 #ifndef HTTP_SERVER
 #define HTTP_SERVER "Micro CHTTP Server"
 #endif
@@ -34,6 +63,36 @@
 #ifndef HTTP_CONN_IDLE_TIMEOUT
 #define HTTP_CONN_IDLE_TIMEOUT 15
 #endif
+/* Maximum number of requests served on one persistent (keep-alive) connection.
+   The response to the last one carries "Connection: close". */
+#ifndef HTTP_MAX_KEEPALIVE_REQUESTS
+#define HTTP_MAX_KEEPALIVE_REQUESTS 100
+#endif
+/* Multi-worker mode: run this many threads, each with its own HTTPServer,
+   connection pool and SO_REUSEPORT listening socket, so that the kernel spreads
+   the connections over the cores. 0 keeps the single-threaded server; the
+   embedded (lwIP) build is always single-threaded. */
+#if (LWIP == 1) || !defined(HTTP_WORKERS)
+#undef HTTP_WORKERS
+#define HTTP_WORKERS 0
+#endif
+/* Zero-copy file bodies: a response may hand an open file descriptor to the
+   connection (HTTPRespMessage.BodyFd), which is then sent with sendfile()
+   without copying it through _buf. Linux only; lwIP always streams through
+   the BodyCB callback. */
+#ifndef HTTP_USE_SENDFILE
+#if (LWIP == 0) && defined(__linux__)
+#define HTTP_USE_SENDFILE 1
+#else
+#define HTTP_USE_SENDFILE 0
+#endif
+#endif
+
+/* A response can queue this many pieces of data by reference with
+   HTTPRespAppend(); they go out after _buf in the same send call. */
+#ifndef HTTP_RESP_SEGMENTS
+#define HTTP_RESP_SEGMENTS 4
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,44 +100,87 @@ extern "C" {
 
 typedef int SOCKET;
 
+#include "poller.h"
+
 // this function is called whenever there is body data to be processed.
 // When the function is NULL in the request class, the data will be ditched for the request.
 // When this function returns 0 for the response, the stream will terminate.
 // The context field can be used to identify which stream this call belongs to.
 typedef int (*HTTPBODY_IN_CALLBACK)(void *context, const uint8_t *data, int size);
 typedef int (*HTTPBODY_OUT_CALLBACK)(void *context, uint8_t *data, int size);
+// Called with the response BodyContext once a BodyData or BodyCB body is sent, or the connection closed.
+typedef void (*HTTPBODY_RELEASE_CALLBACK)(void *context);
 
-typedef struct _HTTPServer
-{
-    SOCKET sock;
-    SOCKET _max_sock;
-    fd_set _read_sock_pool;
-    fd_set _write_sock_pool;
-    int available_connections;
-} HTTPServer;
+/* Standard header names known to the parser, in the order of NAMES in
+   headerhash.py. A request header is found by its ID without comparing names. */
+typedef enum {
+    HTTP_HDR_UNKNOWN,
+    HTTP_HDR_ACCEPT,
+    HTTP_HDR_ACCEPT_CHARSET,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_ACCEPT_LANGUAGE,
+    HTTP_HDR_AUTHORIZATION,
+    HTTP_HDR_CACHE_CONTROL,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_CONTENT_DISPOSITION,
+    HTTP_HDR_CONTENT_ENCODING,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_CONTENT_RANGE,
+    HTTP_HDR_CONTENT_TYPE,
+    HTTP_HDR_COOKIE,
+    HTTP_HDR_DATE,
+    HTTP_HDR_EXPECT,
+    HTTP_HDR_FORWARDED,
+    HTTP_HDR_HOST,
+    HTTP_HDR_IF_MATCH,
+    HTTP_HDR_IF_MODIFIED_SINCE,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_IF_RANGE,
+    HTTP_HDR_IF_UNMODIFIED_SINCE,
+    HTTP_HDR_KEEP_ALIVE,
+    HTTP_HDR_ORIGIN,
+    HTTP_HDR_PRAGMA,
+    HTTP_HDR_RANGE,
+    HTTP_HDR_REFERER,
+    HTTP_HDR_TE,
+    HTTP_HDR_TRAILER,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_USER_AGENT,
+    HTTP_HDR_X_FORWARDED_FOR,
+    HTTP_HDR_X_REQUESTED_WITH,
+    HTTP_HDR_COUNT
+} HTTPHeaderID;
 
 typedef struct _HTTPHeaderField
 {
     const char *key;
     const char *value;
+    HTTPHeaderID id;  // set by the request parsers; HTTP_HDR_UNKNOWN otherwise
 } HTTPHeaderField;
 
 #ifndef MAX_HEADER_FIELDS
 #define MAX_HEADER_FIELDS 20
 #endif
 
-typedef enum { HTTP_UNKNOWN, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE } HTTPMethod;
+// The methods of RFC 9110 and PATCH (RFC 5789). Any other token is HTTP_UNKNOWN.
+typedef enum {
+    HTTP_UNKNOWN, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE, HTTP_HEAD,
+    HTTP_CONNECT, HTTP_OPTIONS, HTTP_TRACE, HTTP_PATCH
+} HTTPMethod;
 
 typedef struct _HTTPReqHeader
 {
     char _buffer[HTTP_MAX_HEADER_SIZE+4];
     int _buffer_valid;
+    int _scanned;   // bytes of _buffer already searched for the end of the header
     HTTPMethod Method;
     const char *URI;
     const char *Version;
     const char *Response;
     HTTPHeaderField Fields[MAX_HEADER_FIELDS];
     unsigned int FieldCount;
+    const char *Known[HTTP_HDR_COUNT]; // value of the first field with each known name, also beyond Fields
     void *RawCopy;
     int RawCopySize;
     int RawCopyLength;
@@ -102,6 +204,7 @@ typedef enum {
     eChunkHeader,
     eChunkBody,
     eChunkTrailer,
+    eChunkFinal,
 } t_ChunkState;
 
 typedef struct _HTTPReqMessage
@@ -120,6 +223,9 @@ typedef struct _HTTPReqMessage
     uint8_t  _buf[HTTP_BUFFER_SIZE+4]; // receive buffer
     int      _valid;
     int      _used;
+    int      KeepAlive; // client allows the connection to persist after this request
+    int      _requests; // number of requests received on this connection
+    void    *_multipart; // multipart parser, kept for the next upload (see ReleaseReqMessage)
 } HTTPReqMessage;
 
 typedef struct _HTTPRespHeader
@@ -131,22 +237,115 @@ typedef struct _HTTPRespHeader
     unsigned int FieldCount;
 } HTTPRespHeader;
 
+typedef struct
+{
+    const uint8_t *data;
+    size_t length;
+} HTTPRespSegment;
+
 typedef struct _HTTPRespMessage
 {
     HTTPRespHeader Header;
     HTTPBODY_OUT_CALLBACK BodyCB;
     void *BodyContext;
+    const uint8_t *BodyData;   // non-NULL: send BodyDataLength bytes from here, after _buf
+    size_t BodyDataLength;
+    HTTPBODY_RELEASE_CALLBACK BodyRelease;
+#if HTTP_USE_SENDFILE
+    int BodyFd;        // >= 0: send BodyLength bytes of this file from BodyOffset, after _buf
+    off_t BodyOffset;  // the connection closes BodyFd when done
+    size_t BodyLength;
+#endif
+    int KeepAlive; // set by the application when the response is length-delimited
     size_t _index;
+    HTTPRespSegment _segments[HTTP_RESP_SEGMENTS]; // sent after _buf, before the body
+    int _segment_count;
+    int _segment_sent;  // segments that are completely sent
     uint8_t _buf[HTTP_BUFFER_SIZE+4];
 } HTTPRespMessage;
 
+/* The request and response of a connection, with their buffers. */
+typedef struct _HTTPConnIO
+{
+    HTTPReqMessage req;
+    HTTPRespMessage res;
+    struct _HTTPConnIO *_next; // spare list of the server
+} HTTPConnIO;
+
+/* One client connection. Its I/O buffers (io) are attached when a request
+   starts to arrive and given back while the connection is idle, so an open
+   but quiet connection only costs this struct. */
+typedef struct _HTTPReq
+{
+    SOCKET clisock;
+    HTTPConnIO *io;
+    int _requests; // requests served, kept while io is detached
+    size_t windex;
+    uint8_t work_state;
+    uint32_t last_active_ms;
+    struct _HTTPReq *_next; // free list of the slab, or list of active connections
+    struct _HTTPReq *_prev;
+    struct _HTTPSlab *_slab;
+} HTTPReq;
+
+typedef struct _HTTPServer
+{
+    SOCKET sock;
+    HTTPPoller poller;
+    int max_connections;
+    int available_connections;
+    int accept_paused;
+    uint32_t last_reap_ms;
+    // The connection pool of this server
+    HTTPReq *active;            // connections in use
+    struct _HTTPSlab *partial;  // slabs with at least one free connection
+    struct _HTTPSlab *spare;    // one completely free slab, kept for reuse
+    HTTPConnIO *spare_io;       // detached I/O buffers, kept for reuse
+    int spare_io_count;
+} HTTPServer;
+
 void InitReqMessage(HTTPReqMessage *req);
+// Prepare the request message for the next request on a persistent connection.
+void ResetReqMessage(HTTPReqMessage *req);
+// Free what the request message allocated for its bodies, before the message is freed.
+void ReleaseReqMessage(HTTPReqMessage *req);
 void InitRespMessage(HTTPRespMessage *resp);
+// Queue length bytes at data to be sent after what is in _buf, without copying
+// them. The data must stay valid until the response is sent (or BodyRelease is
+// called). A piece that continues the previous one is merged with it. Returns
+// -1 when HTTP_RESP_SEGMENTS pieces are queued already.
+int HTTPRespAppend(HTTPRespMessage *resp, const void *data, size_t length);
+// First '\n' in [p, end), or NULL. Vectorized with SSE2/AVX2 when the compiler
+// targets them, eight bytes at a time otherwise.
+const char *HTTPScanLF(const char *p, const char *end);
+// Method of a request line token of 'len' characters.
+HTTPMethod HaveMethod(const char *method, size_t len);
+// Value of a request header field (case-insensitive name), or NULL when absent.
+const char *GetReqHeader(HTTPReqMessage *req, const char *key);
+// ID of a header name of 'len' characters (case-insensitive), or HTTP_HDR_UNKNOWN.
+HTTPHeaderID HTTPHeaderLookup(const char *name, size_t len);
+// Value of a known request header, or NULL when absent. O(1).
+#define GetReqHeaderById(req, id) ((req)->Header.Known[id])
+// Write an HTTP date (IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT") into buf, which
+// must hold HTTP_DATE_SIZE bytes. Returns the length written.
+#define HTTP_DATE_SIZE 30
+int HTTPFormatDate(char *buf, time_t t);
+// Parse an HTTP date (any of the three RFC 9110 formats). Returns (time_t)-1 when invalid.
+time_t HTTPParseDate(const char *s);
+
+// Value of the "Connection" response header. An application that frames its
+// response (Content-Length) may keep the connection: resp->KeepAlive = req->KeepAlive.
+#define HTTPConnectionValue(resp) ((resp)->KeepAlive ? "keep-alive" : "close")
 
 typedef void (*HTTPREQ_CALLBACK)(HTTPReqMessage *, HTTPRespMessage *);
 uint8_t ProcessClientData(HTTPReqMessage *req, HTTPRespMessage *resp, HTTPREQ_CALLBACK callback);
 
 void HTTPServerInit(HTTPServer *, uint16_t);
+// Same, but the listening socket is opened with SO_REUSEPORT so that several
+// servers (one per worker thread) can share the port.
+void HTTPServerInitReusePort(HTTPServer *, uint16_t);
+// Change the maximum number of simultaneous connections (default MAX_HTTP_CLIENT).
+void HTTPServerSetMaxConnections(HTTPServer *, int);
 void HTTPServerRun(HTTPServer *, HTTPREQ_CALLBACK);
 #define HTTPServerRunLoop(srv, callback)                                                                               \
     {                                                                                                                  \
@@ -155,6 +354,12 @@ void HTTPServerRun(HTTPServer *, HTTPREQ_CALLBACK);
         }                                                                                                              \
     }
 void HTTPServerClose(HTTPServer *);
+#if HTTP_WORKERS
+// Start 'workers' threads (0: one per online CPU) that each run their own
+// server on 'port', and serve forever. Returns only when no worker could start.
+// max_connections applies per worker; 0 keeps the default.
+int HTTPServerRunWorkers(uint16_t port, int workers, int max_connections, HTTPREQ_CALLBACK);
+#endif
 //typedef void (*SOCKET_CALLBACK)(void *);
 
 #define NOTWORK_SOCKET 0
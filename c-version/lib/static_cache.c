@@ -0,0 +1,289 @@
+#include "static_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#if HTTP_WORKERS
+#include <pthread.h>
+#endif
+
+/* With HTTP_WORKERS the cache is shared by all worker threads. */
+#if HTTP_WORKERS
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CACHE_LOCK() pthread_mutex_lock(&_cache_lock)
+#define CACHE_UNLOCK() pthread_mutex_unlock(&_cache_lock)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+static StaticCacheEntry *_buckets[HTTP_STATIC_CACHE_BUCKETS];
+static StaticCacheEntry *_newest;
+static StaticCacheEntry *_oldest;
+static size_t _usage;
+
+static uint32_t _Hash(const char *s)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void _LruUnlink(StaticCacheEntry *e)
+{
+    if (e->_newer)
+        e->_newer->_older = e->_older;
+    else
+        _newest = e->_older;
+    if (e->_older)
+        e->_older->_newer = e->_newer;
+    else
+        _oldest = e->_newer;
+}
+
+static void _LruPush(StaticCacheEntry *e)
+{
+    e->_newer = NULL;
+    e->_older = _newest;
+    if (_newest)
+        _newest->_newer = e;
+    else
+        _oldest = e;
+    _newest = e;
+}
+
+static StaticCacheEntry *_Find(const char *path, uint32_t hash)
+{
+    StaticCacheEntry *e = _buckets[hash % HTTP_STATIC_CACHE_BUCKETS];
+    while (e && ((e->_hash != hash) || strcmp(e->path, path)))
+        e = e->_hnext;
+    return e;
+}
+
+/* Take an entry out of the cache. It is freed now, or by the last response
+   that is still sending it. */
+static void _Remove(StaticCacheEntry *e)
+{
+    StaticCacheEntry **pp = _buckets + (e->_hash % HTTP_STATIC_CACHE_BUCKETS);
+    while (*pp != e)
+        pp = &((*pp)->_hnext);
+    *pp = e->_hnext;
+    _LruUnlink(e);
+    _usage -= e->_size;
+    e->_cached = 0;
+    if (e->_refs == 0)
+        free(e);
+}
+
+/* Evict least recently used entries until 'need' more bytes fit. Entries that
+   are being sent cannot be evicted. Returns 0 when there is room. */
+static int _MakeRoom(size_t need)
+{
+    StaticCacheEntry *e = _oldest;
+
+    while (e && (_usage + need > HTTP_STATIC_CACHE_SIZE)) {
+        StaticCacheEntry *newer = e->_newer;
+        if (e->_refs == 0)
+            _Remove(e);
+        e = newer;
+    }
+    return (_usage + need <= HTTP_STATIC_CACHE_SIZE) ? 0 : -1;
+}
+
+/* Read a file into a new, unlinked entry. */
+static StaticCacheEntry *_Load(const char *path, const struct stat *st, const char *mime_type, uint32_t hash)
+{
+    StaticCacheEntry *e;
+    char header[256];
+    char etag[40];
+    char date[HTTP_DATE_SIZE];
+    size_t path_len = strlen(path);
+    size_t length = (size_t)st->st_size;
+    size_t done = 0;
+    int header_len, fd;
+    uint8_t *body;
+
+    StaticFileETag(etag, sizeof(etag), st->st_mtime, length);
+    HTTPFormatDate(date, st->st_mtime);
+    header_len = snprintf(header, sizeof(header), "Content-Type: %s\r\nContent-Length: %lu\r\n"
+        "Last-Modified: %s\r\nETag: %s\r\n", mime_type, (unsigned long)length, date, etag);
+    if ((header_len < 0) || (header_len >= (int)sizeof(header)))
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    e = (StaticCacheEntry *)malloc(sizeof(StaticCacheEntry) + path_len + header_len + length);
+    if (!e) {
+        close(fd);
+        return NULL;
+    }
+    memcpy(e->path, path, path_len + 1);
+    memcpy(e->path + path_len + 1, header, header_len);
+    body = (uint8_t *)(e->path + path_len + 1 + header_len);
+    while (done < length) {
+        ssize_t n = read(fd, body + done, length - done);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    if (done != length) {
+        free(e); // the file changed while it was read
+        return NULL;
+    }
+
+    e->_hnext = e->_newer = e->_older = NULL;
+    e->_hash = hash;
+    e->_refs = 1;
+    e->_cached = 0;
+    e->_size = sizeof(StaticCacheEntry) + path_len + header_len + length;
+    e->mtime = st->st_mtime;
+    e->length = length;
+    e->body = body;
+    e->header = e->path + path_len + 1;
+    e->header_length = header_len;
+    strcpy(e->etag, etag);
+    e->_siblings = 0;
+    e->_siblings_checked = 0;
+    return e;
+}
+
+void StaticFileETag(char *etag, size_t size, time_t mtime, size_t length)
+{
+    snprintf(etag, size, "\"%lx-%lx\"", (unsigned long)mtime, (unsigned long)length);
+}
+
+unsigned StaticFileSiblings(const char *path, const char *const *suffixes)
+{
+    char sibling[256];
+    size_t n = strlen(path);
+    unsigned siblings = 0;
+    struct stat st;
+
+    for (int i = 0; suffixes && suffixes[i]; i++) {
+        if (n + strlen(suffixes[i]) >= sizeof(sibling))
+            continue;
+        memcpy(sibling, path, n);
+        strcpy(sibling + n, suffixes[i]);
+        if ((stat(sibling, &st) == 0) && S_ISREG(st.st_mode))
+            siblings |= 1u << i;
+    }
+    return siblings;
+}
+
+static StaticCacheEntry *_Lookup(const char *path, const char *mime_type)
+{
+    StaticCacheEntry *e, *loaded;
+    uint32_t hash = _Hash(path);
+    struct stat st;
+    int exists = (stat(path, &st) == 0) && S_ISREG(st.st_mode);
+
+    CACHE_LOCK();
+    e = _Find(path, hash);
+    if (e && (!exists || (e->mtime != st.st_mtime) || (e->length != (size_t)st.st_size))) {
+        _Remove(e); // changed or removed on disk
+        e = NULL;
+    }
+    if (e) {
+        e->_refs++;
+        _LruUnlink(e);
+        _LruPush(e);
+    }
+    CACHE_UNLOCK();
+    if (e || !exists || ((size_t)st.st_size > HTTP_STATIC_CACHE_MAX_FILE))
+        return e;
+
+    /* Read the file without holding the lock. */
+    loaded = _Load(path, &st, mime_type, hash);
+    if (!loaded)
+        return NULL;
+
+    CACHE_LOCK();
+    e = _Find(path, hash);
+    if (e)
+        _Remove(e); // loaded by another worker meanwhile; keep the newest copy
+    if (_MakeRoom(loaded->_size) == 0) {
+        loaded->_hnext = _buckets[hash % HTTP_STATIC_CACHE_BUCKETS];
+        _buckets[hash % HTTP_STATIC_CACHE_BUCKETS] = loaded;
+        _LruPush(loaded);
+        _usage += loaded->_size;
+        loaded->_cached = 1;
+    }
+    // else: no room, the entry serves this response only and is freed by its release
+    CACHE_UNLOCK();
+    return loaded;
+}
+
+/* Siblings of a referenced entry, looked up on disk again once they are
+   HTTP_STATIC_CACHE_RECHECK seconds old. */
+static unsigned _Siblings(StaticCacheEntry *e, const char *const *suffixes)
+{
+    time_t now = time(NULL);
+    unsigned siblings;
+    int fresh;
+
+    CACHE_LOCK();
+    siblings = e->_siblings;
+    fresh = e->_siblings_checked && ((now - e->_siblings_checked) < HTTP_STATIC_CACHE_RECHECK);
+    CACHE_UNLOCK();
+    if (fresh)
+        return siblings;
+
+    siblings = StaticFileSiblings(e->path, suffixes);
+    CACHE_LOCK();
+    e->_siblings = siblings;
+    e->_siblings_checked = now;
+    CACHE_UNLOCK();
+    return siblings;
+}
+
+StaticCacheEntry *StaticCacheLookup(const char *path, const char *mime_type, const char *const *suffixes,
+    unsigned *siblings)
+{
+    StaticCacheEntry *e = _Lookup(path, mime_type);
+
+    if (e && suffixes)
+        *siblings = _Siblings(e, suffixes);
+    return e;
+}
+
+void StaticCacheRelease(void *entry)
+{
+    StaticCacheEntry *e = (StaticCacheEntry *)entry;
+
+    CACHE_LOCK();
+    if ((--e->_refs == 0) && !e->_cached)
+        free(e);
+    CACHE_UNLOCK();
+}
+
+size_t StaticCacheUsage(void)
+{
+    size_t usage;
+
+    CACHE_LOCK();
+    usage = _usage;
+    CACHE_UNLOCK();
+    return usage;
+}
+
+void StaticCacheFlush(void)
+{
+    StaticCacheEntry *e;
+
+    CACHE_LOCK();
+    e = _oldest;
+    while (e) {
+        StaticCacheEntry *newer = e->_newer;
+        if (e->_refs == 0)
+            _Remove(e);
+        e = newer;
+    }
+    CACHE_UNLOCK();
+}
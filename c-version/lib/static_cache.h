@@ -0,0 +1,77 @@
+#ifndef __MICRO_HTTP_STATIC_CACHE_H__
+#define __MICRO_HTTP_STATIC_CACHE_H__
+
+#include "server.h"
+#include <time.h>
+
+/* In-memory cache of static files. Small, frequently requested files are kept
+   in RAM together with their prebuilt response header lines, so a hit costs a
+   stat() (to detect changes on disk) instead of fopen/fread/sprintf. Entries
+   are evicted least-recently-used first when the memory budget is exceeded. */
+
+// Total number of bytes (file bodies plus headers) the cache may hold. 0 disables it.
+#ifndef HTTP_STATIC_CACHE_SIZE
+#define HTTP_STATIC_CACHE_SIZE (4 * 1024 * 1024)
+#endif
+// Larger files are not cached; they are sent from disk (see HTTP_USE_SENDFILE).
+#ifndef HTTP_STATIC_CACHE_MAX_FILE
+#define HTTP_STATIC_CACHE_MAX_FILE (256 * 1024)
+#endif
+#ifndef HTTP_STATIC_CACHE_BUCKETS
+#define HTTP_STATIC_CACHE_BUCKETS 64
+#endif
+// Seconds that the siblings found next to a cached file are trusted before
+// they are looked up on disk again.
+#ifndef HTTP_STATIC_CACHE_RECHECK
+#define HTTP_STATIC_CACHE_RECHECK 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _StaticCacheEntry
+{
+    struct _StaticCacheEntry *_hnext;  // hash bucket chain
+    struct _StaticCacheEntry *_newer;  // LRU list, most recently used at the head
+    struct _StaticCacheEntry *_older;
+    uint32_t _hash;
+    int _refs;       // responses still sending this entry
+    int _cached;     // 0 once evicted or invalidated; freed with the last reference
+    size_t _size;    // bytes allocated for the entry
+    time_t mtime;
+    size_t length;   // of body
+    const uint8_t *body;
+    const char *header;   // Content-Type, Content-Length, Last-Modified and ETag lines
+    size_t header_length;
+    char etag[40];        // quoted strong entity tag
+    unsigned _siblings;       // bit i: path + suffixes[i] exists
+    time_t _siblings_checked; // when _siblings was found; 0: not yet
+    char path[1];         // normalized file path (key), allocated with the entry
+} StaticCacheEntry;
+
+/* Look up a file by its normalized path, loading it when it is not cached yet
+   or has changed on disk. Returns a referenced entry, or NULL when the file does
+   not exist, is too large to cache, or does not fit in the budget. Every entry
+   returned must be given back with StaticCacheRelease(). With suffixes (NULL
+   terminated), *siblings is set to the siblings of the file that exist (see
+   StaticFileSiblings()); a hit only looks for them on disk again once they
+   are HTTP_STATIC_CACHE_RECHECK seconds old. */
+StaticCacheEntry *StaticCacheLookup(const char *path, const char *mime_type, const char *const *suffixes,
+    unsigned *siblings);
+// Drop a reference. Matches HTTPBODY_RELEASE_CALLBACK, so it can be the release of a response body.
+void StaticCacheRelease(void *entry);
+// Write the strong entity tag used for a file of this mtime and length.
+void StaticFileETag(char *etag, size_t size, time_t mtime, size_t length);
+// Bitmask of the siblings path + suffixes[i] that exist as regular files.
+unsigned StaticFileSiblings(const char *path, const char *const *suffixes);
+// Number of bytes currently held by the cache.
+size_t StaticCacheUsage(void);
+// Remove every unreferenced entry.
+void StaticCacheFlush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
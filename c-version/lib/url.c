@@ -3,7 +3,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "url.h"
 
@@ -22,52 +27,171 @@ const char *supported_apiversions[] = {"v1",
                                        //"v2",
                                        NULL};
 
-void url_decode(char *src, char *dest, int max)
+/* Value of a hex digit, -1 for other characters. */
+static const int8_t _hex[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* First a or b in [p, end), or NULL. Vectorized like HTTPScanLF(). */
+static const char *_Scan2(const char *p, const char *end, char a, char b)
+{
+#if defined(__AVX2__)
+    const __m256i a32 = _mm256_set1_epi8(a), b32 = _mm256_set1_epi8(b);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, a32), _mm256_cmpeq_epi8(v, b32)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i a16 = _mm_set1_epi8(a), b16 = _mm_set1_epi8(b);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, a16), _mm_cmpeq_epi8(v, b16)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    const uint64_t a8 = 0x0101010101010101ull * (uint8_t)a, b8 = 0x0101010101010101ull * (uint8_t)b;
+    while (end - p >= 8) {
+        uint64_t w, x, y;
+        memcpy(&w, p, 8);
+        x = w ^ a8;
+        y = w ^ b8;
+        if ((((x - 0x0101010101010101ull) & ~x) | ((y - 0x0101010101010101ull) & ~y)) & 0x8080808080808080ull)
+            break; // a or b is in these eight bytes
+        p += 8;
+    }
+#endif
+    for (; p < end; p++) {
+        if ((*p == a) || (*p == b))
+            return p;
+    }
+    return NULL;
+}
+
+/* Decode [p, end) into at most room characters at dest, which may be p.
+   Returns the end of the output. Runs without escapes are moved at once. */
+static char *_Decode(const char *p, const char *end, char *dest, size_t room)
 {
-    char *p = src;
-    char code[3] = {0};
-    while (*p && --max) {
-        if (*p == '%') {
-            // Only decode when two hex digits actually follow; otherwise copy the
-            // '%' literally. A truncated escape ("...%" / "...%A") otherwise made
-            // the scan run past the end of the string, reading and writing out of
-            // bounds until it hit a stray 0 byte. The p[1]/p[2] existence checks
-            // come first (short-circuit) so isxdigit() is never fed a byte past
-            // the terminating '\0'.
-            if (p[1] && p[2] && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
-                code[0] = p[1];
-                code[1] = p[2];
-                *dest++ = (char)strtoul(code, NULL, 16);
-                p += 2;
-            } else {
-                *dest++ = *p;
-            }
-        } else if (*p == '+') {
+    while ((p < end) && room) {
+        const char *s = _Scan2(p, end, '%', '+');
+        size_t run = (s ? s : end) - p;
+        int hi, lo;
+
+        if (run > room)
+            run = room;
+        if (dest != p)
+            memmove(dest, p, run);
+        dest += run;
+        p += run;
+        room -= run;
+        if ((p != s) || !room)
+            break;
+        if (*p == '+') {
             *dest++ = ' ';
+            p++;
+        } else if ((end - p >= 3) && ((hi = _hex[(uint8_t)p[1]]) >= 0) && ((lo = _hex[(uint8_t)p[2]]) >= 0)) {
+            // Only decode when two hex digits actually follow; otherwise copy
+            // the '%' literally, also at the end of the string.
+            *dest++ = (char)((hi << 4) | lo);
+            p += 3;
         } else {
-            *dest++ = *p;
+            *dest++ = *p++;
         }
-        p++;
+        room--;
     }
-    *dest = '\0';
+    return dest;
 }
 
-struct Parameter *parse_querystring(char *querystring_copy, size_t *parameters_len)
+void url_decode(char *src, char *dest, int max)
 {
-    struct Parameter *parameters;
+    char *end = _Decode(src, src + strlen(src), dest, (max > 0) ? (size_t)(max - 1) : (size_t)-1);
+    *end = '\0';
+}
 
-    char *token, *name, *value;
+/* Split a writable querystring into at most max name-value pairs, in place,
+   in one pass over it. With lazy, values are left encoded until they are
+   asked for with url_parameter_value(). */
+static size_t _SplitQuerystring(char *querystring_copy, struct Parameter *parameters, size_t max, int lazy)
+{
     static const char *empty = "";
+    char *p = querystring_copy;
+    char *end = p + strlen(p);
+    size_t index = 0;
+
+    if (p == end)
+        return 0;
+
+    while (index < max) {
+        char *s = (char *)_Scan2(p, end, '&', '=');
+        char *amp;
+
+        parameters[index].name = p; // no need to URL decode this
+        parameters[index].encoded = 0;
+        if (s && (*s == '=')) {
+            *s++ = 0;
+            amp = (char *)_Scan2(s, end, '&', '&');
+            if (!amp)
+                amp = end;
+            if (lazy)
+                parameters[index].encoded = (amp > s);
+            else
+                *_Decode(s, amp, s, amp - s) = 0;
+            parameters[index].value = s;
+        } else {
+            amp = s ? s : end;
+            parameters[index].value = empty;
+        }
+        index++;
+        if (amp == end)
+            break;
+        *amp = 0;
+        p = amp + 1;
+    }
+    return index;
+}
 
-    *parameters_len = 0;
-    if (strlen(querystring_copy) == 0) {
-        return NULL;
+static size_t _CountParameters(const char *querystring)
+{
+    const char *end = querystring + strlen(querystring);
+    size_t count = 1;
+
+    if (querystring == end)
+        return 0;
+    while ((querystring = _Scan2(querystring, end, '&', '&')) != NULL) {
+        querystring++;
+        count++;
     }
+    return count;
+}
 
-    *parameters_len = 1;
-    for (int i = 0; i < strlen(querystring_copy); i++) {
-        if (querystring_copy[i] == '&')
-            (*parameters_len)++;
+struct Parameter *parse_querystring(char *querystring_copy, size_t *parameters_len)
+{
+    struct Parameter *parameters;
+
+    *parameters_len = _CountParameters(querystring_copy);
+    if (*parameters_len == 0) {
+        return NULL;
     }
 
     parameters = (struct Parameter *)malloc(*parameters_len * sizeof(struct Parameter));
@@ -76,20 +200,32 @@ struct Parameter *parse_querystring(char *querystring_copy, size_t *parameters_l
         return NULL;
     }
 
-    int index = 0;
-    while ((value = token = strsep(&querystring_copy, "&")) != NULL) {
-        name = strsep(&value, "=");
-        parameters[index].name = name; // no need to URL decode this
-        if (value == NULL) {
-            parameters[index].value = empty;
-        } else {
-            url_decode(value, value, 0);
-            parameters[index].value = value;
-        }
-        index++;
+    _SplitQuerystring(querystring_copy, parameters, *parameters_len, 0);
+    return parameters;
+}
+
+const char *url_parameter_value(UrlComponents *c, size_t index)
+{
+    struct Parameter *parameter;
+
+    if (index >= c->parameters_len)
+        return NULL;
+    parameter = &(c->parameters[index]);
+    if (parameter->encoded) {
+        // decoded in place: the value only gets shorter
+        url_decode((char *)parameter->value, (char *)parameter->value, 0);
+        parameter->encoded = 0;
     }
+    return parameter->value;
+}
 
-    return parameters;
+const char *url_parameter(UrlComponents *c, const char *name)
+{
+    for (size_t i = 0; i < c->parameters_len; i++) {
+        if (!strcmp(c->parameters[i].name, name))
+            return url_parameter_value(c, i);
+    }
+    return NULL;
 }
 
 void delete_url_components(UrlComponents *components)
@@ -111,18 +247,15 @@ int parse_header_to_url_components(HTTPReqHeader *hdr, UrlComponents *c)
     return ret;
 }
 
-int parse_url_static(const char *url, UrlComponents *components)
+/* Split a writable copy of the url (without its leading '/') into the
+   components, which point into the copy. */
+static int _SplitUrl(char *url_copy, UrlComponents *components)
 {
     int supported_version = 0;
 
-    char *url_copy, *url_start, *token;
-
-    if (url[0] == '/')
-        url++;
+    char *url_start, *token;
 
-    url_copy = token = url_start = strdup(url);
-    if (!url_copy)
-        return -1; // out of memory
+    token = url_start = url_copy;
     static const char *empty = "";
 
     // Consume apiversion first (a little dirty, but we need to handle it some way)
@@ -133,7 +266,6 @@ int parse_url_static(const char *url, UrlComponents *components)
     // terminator when there was no '/', reading out of bounds.
     if (!token) {
         components->apiversion = empty; // don't leave apiversion pointing into the freed copy
-        free(url_copy);
         return -1; // nothing follows the version -> no route
     }
     url_start = token;
@@ -146,7 +278,6 @@ int parse_url_static(const char *url, UrlComponents *components)
 
     if (!supported_version) {
         components->apiversion = empty; // don't leave apiversion pointing into the freed copy
-        free(url_copy);
         return -1; // Not supported
     }
 
@@ -180,6 +311,87 @@ int parse_url_static(const char *url, UrlComponents *components)
     return 0;
 }
 
+int parse_url_static(const char *url, UrlComponents *components)
+{
+    char *url_copy;
+
+    if (url[0] == '/')
+        url++;
+
+    url_copy = strdup(url);
+    if (!url_copy)
+        return -1; // out of memory
+    if (_SplitUrl(url_copy, components)) {
+        free(url_copy);
+        return -1;
+    }
+    return 0;
+}
+
+static void *_ArenaAlloc(UrlArena *arena, size_t size, size_t align)
+{
+    uintptr_t p = ((uintptr_t)(arena->base + arena->used) + align - 1) & ~(uintptr_t)(align - 1);
+    size_t used = (p - (uintptr_t)arena->base) + size;
+
+    if (used > arena->size)
+        return NULL;
+    arena->used = used;
+    return (void *)p;
+}
+
+int parse_querystring_arena(const char *querystring, UrlComponents *components, UrlArena *arena)
+{
+    size_t len, count;
+    char *querystring_copy;
+    struct Parameter *parameters;
+
+    components->querystring = querystring;
+    components->querystring_copy = NULL;
+    components->parameters = NULL;
+    components->parameters_len = 0;
+
+    count = _CountParameters(querystring);
+    if (count == 0)
+        return 0;
+    if (count > URL_MAX_PARAMETERS)
+        count = URL_MAX_PARAMETERS;
+    len = strlen(querystring) + 1;
+    querystring_copy = (char *)_ArenaAlloc(arena, len, 1);
+    parameters = (struct Parameter *)_ArenaAlloc(arena, count * sizeof(struct Parameter), sizeof(void *));
+    if (!querystring_copy || !parameters)
+        return -1;
+    memcpy(querystring_copy, querystring, len);
+    components->querystring_copy = querystring_copy;
+    components->parameters = parameters;
+    components->parameters_len = _SplitQuerystring(querystring_copy, parameters, count, 1);
+    return 0;
+}
+
+int parse_url_arena(const char *url, UrlComponents *components, UrlArena *arena)
+{
+    size_t len;
+    char *url_copy;
+
+    if (url[0] == '/')
+        url++;
+
+    len = strlen(url) + 1;
+    url_copy = (char *)_ArenaAlloc(arena, len, 1);
+    if (!url_copy)
+        return -1;
+    memcpy(url_copy, url, len);
+    if (_SplitUrl(url_copy, components))
+        return -1;
+    return parse_querystring_arena(components->querystring, components, arena);
+}
+
+int parse_url_header_arena(HTTPReqHeader *hdr, UrlComponents *c, UrlArena *arena)
+{
+    int ret = parse_url_arena(hdr->URI, c, arena);
+    c->method = hdr->Method;
+    return ret;
+}
+
 UrlComponents *parse_url(const char *url)
 {
     // C-style 'new'.
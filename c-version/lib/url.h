@@ -5,9 +5,15 @@
 
 #define MAX_STR_LEN 512
 
+// Parameters kept by parse_url_arena(); further ones are ignored.
+#ifndef URL_MAX_PARAMETERS
+#define URL_MAX_PARAMETERS 16
+#endif
+
 struct Parameter {
     const char *name;
     const char *value;
+    int encoded;  // value still has to be url decoded: read it with url_parameter_value()
 };
 
 typedef struct _UrlComponents {
@@ -25,12 +31,33 @@ typedef struct _UrlComponents {
     char *querystring_copy;
 } UrlComponents;
 
+/* Caller-provided memory to parse into, e.g. a buffer on the stack. Set used
+   to 0 to reuse it. */
+typedef struct {
+    char  *base;
+    size_t size;
+    size_t used;
+} UrlArena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*
 Extract name-value pairs from the querystring. Allocates memory for an array of struct Parameter,
 which also includes memory allocation for name and value strings.
 */
 struct Parameter *parse_querystring(char *querystring, size_t *parameters_len);
 
+/*
+Value of parameter index, or of the first parameter with the given name. parse_url_arena()
+leaves the values encoded (see struct Parameter); a value is decoded in place the first time
+it is asked for. parse_url() decodes all values up front. Returns NULL when there is no such
+parameter.
+*/
+const char *url_parameter_value(UrlComponents *c, size_t index);
+const char *url_parameter(UrlComponents *c, const char *name);
+
 /*
 Extract the different parts of the url. Allocates memory for a UrlComponents. Makes a call
 to parse_querystring() which also allocates memory.
@@ -65,6 +92,24 @@ This function will also set the http method correctly.
 */
 int parse_header_to_url_components(HTTPReqHeader *hdr, UrlComponents *c);
 
+/*
+Parse the given url and extract all parts, like parse_url(), into the given UrlComponents
+without any heap allocation: the copies of url and querystring and at most URL_MAX_PARAMETERS
+parameters are taken from the arena. The parameter values are left encoded; read them with
+url_parameter() or url_parameter_value(). Returns -1 when the url is not an API url, or when it
+does not fit in the arena. The components are released with the arena; do NOT call
+delete_url_components() on them.
+*/
+int parse_url_arena(const char *url, UrlComponents *c, UrlArena *arena);
+int parse_url_header_arena(HTTPReqHeader *hdr, UrlComponents *c, UrlArena *arena);
+
+/*
+Split querystring (without its '?') into the parameters of c, like parse_url_arena() does:
+only the querystring, querystring_copy and parameter fields of c are set. Returns -1 when
+it does not fit in the arena.
+*/
+int parse_querystring_arena(const char *querystring, UrlComponents *c, UrlArena *arena);
+
 /*
 Function to convert a URL encoded string to a regular string
 When max is set to 0, it will have no limit on the length, but
@@ -73,4 +118,7 @@ this mode is perfect for "in place" replacements, when src == dest.
 */
 void url_decode(char *src, char *dest, int max);
 
+#ifdef __cplusplus
+}
+#endif
 #endif
@@ -1,6 +1,7 @@
 #include "server.h"
 #include "middleware.h"
 #include "url.h"
+#include "dummy_api.h"
 
 /* The HTTP server of this process. */
 HTTPServer srv;
@@ -16,11 +17,26 @@ void SigRoutine_INT(int unused) {
 #endif
 
 int main(void) {
+	/* The connection limit can be sized per deployment. */
+	const char *max_clients = getenv("MHS_MAX_CLIENTS");
+	int max_connections = max_clients ? atoi(max_clients) : 0;
+
+	/* Build the route table before serving. */
+	ApiInit();
+#if HTTP_WORKERS
+	/* Run HTTP_WORKERS threads, each with its own server and connection pool,
+	   sharing MHS_PORT through SO_REUSEPORT. */
+	return HTTPServerRunWorkers(MHS_PORT, HTTP_WORKERS, max_connections, Dispatch) ? 1 : 0;
+#else
 	/* Initial the HTTP server and make it listening on MHS_PORT. */
 	HTTPServerInit(&srv, MHS_PORT);
+	if (max_connections > 0) {
+		HTTPServerSetMaxConnections(&srv, max_connections);
+	}
 	/* Run the HTTP server forever. */
 	/* Run the dispatch callback if there is a new request */
 	HTTPServerRunLoop(&srv, Dispatch);
 	HTTPServerClose(&srv);
 	return 0;
+#endif
 }
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../lib/embedded_fs.h"
+
+// The table under test is generated from ../static by the 'embedfs' make target.
+
+class EmbeddedFSTest : public ::testing::Test {
+protected:
+    // SetUp and TearDown executes for each test case.
+    void SetUp() override {
+    }
+
+    void TearDown() override {
+    }
+
+    // Class members are accessible from test cases. Reinitiated before each test.
+    std::string ReadFile(const char *path) {
+        std::ifstream f(path, std::ios::binary);
+        std::stringstream s;
+        s << f.rdbuf();
+        return s.str();
+    }
+};
+
+///////////////////////////////////////////////////////////////
+//                  EMBEDDED FS TESTS                        //
+///////////////////////////////////////////////////////////////
+TEST_F(EmbeddedFSTest, AllFilesFound)
+{
+    ASSERT_EQ(embedded_fs.file_count, 2);
+    for (int i = 0; i < embedded_fs.file_count; i++) {
+        EXPECT_EQ(EmbeddedFSLookup(embedded_fs.files[i].path), embedded_fs.files + i);
+    }
+}
+
+TEST_F(EmbeddedFSTest, ContentMatchesSource)
+{
+    const EmbeddedFile *f = EmbeddedFSLookup("/sample.html");
+    ASSERT_NE(f, (const EmbeddedFile *)NULL);
+    EXPECT_STREQ(f->mime_type, "text/html");
+    EXPECT_EQ(std::string((const char *)f->data, f->length), ReadFile("../static/sample.html"));
+    // HTML compresses well, so a gzip body (magic 1f 8b) is stored.
+    ASSERT_NE(f->gzip_data, (const uint8_t *)NULL);
+    EXPECT_LT(f->gzip_length, f->length);
+    EXPECT_EQ(f->gzip_data[0], 0x1f);
+    EXPECT_EQ(f->gzip_data[1], 0x8b);
+    // The gzip body has an entity tag of its own.
+    ASSERT_NE(f->gzip_etag, (const char *)NULL);
+    EXPECT_EQ(std::string(f->gzip_etag), std::string(f->etag, strlen(f->etag) - 1) + "-gz\"");
+
+    f = EmbeddedFSLookup("/hehe.jpg");
+    ASSERT_NE(f, (const EmbeddedFile *)NULL);
+    EXPECT_STREQ(f->mime_type, "image/jpeg");
+    EXPECT_EQ(f->length, ReadFile("../static/hehe.jpg").size());
+    EXPECT_EQ(f->gzip_data, (const uint8_t *)NULL); // JPEG does not compress
+    EXPECT_EQ(f->gzip_etag, (const char *)NULL);
+}
+
+TEST_F(EmbeddedFSTest, UnknownPath)
+{
+    EXPECT_EQ(EmbeddedFSLookup("/nope.html"), (const EmbeddedFile *)NULL);
+    EXPECT_EQ(EmbeddedFSLookup("/sample.htm"), (const EmbeddedFile *)NULL);
+    EXPECT_EQ(EmbeddedFSLookup(""), (const EmbeddedFile *)NULL);
+}
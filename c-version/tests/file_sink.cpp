@@ -0,0 +1,183 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../lib/file_sink.h"
+
+static std::vector<FileSinkResult> reports;
+static std::vector<std::string> report_names;
+
+static void Report(void *context, const FileSinkResult *result)
+{
+    reports.push_back(*result);
+    report_names.push_back(result->name);
+}
+
+class FileSinkTest : public ::testing::Test {
+protected:
+    // SetUp and TearDown executes for each test case.
+    void SetUp() override {
+        mkdir("sink_test", 0755);
+        Clean();
+        reports.clear();
+        report_names.clear();
+        sink = FileSinkCreate("sink_test", "raw.bin", &Report, NULL);
+        ASSERT_NE(sink, (FileSink_t *)NULL);
+    }
+
+    void TearDown() override {
+        Clean();
+        rmdir("sink_test");
+    }
+
+    // Class members are accessible from test cases. Reinitiated before each test.
+    FileSink_t *sink;
+
+    void Clean() {
+        for (const std::string &name : Files())
+            unlink(("sink_test/" + name).c_str());
+    }
+
+    std::vector<std::string> Files() {
+        std::vector<std::string> files;
+        DIR *dir = opendir("sink_test");
+        struct dirent *e;
+        while (dir && (e = readdir(dir))) {
+            if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
+                files.push_back(e->d_name);
+        }
+        if (dir)
+            closedir(dir);
+        return files;
+    }
+
+    std::string Contents(const char *name) {
+        std::string path = std::string("sink_test/") + name;
+        std::string data;
+        char buf[4096];
+        size_t n;
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f)
+            return "<missing>";
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            data.append(buf, n);
+        fclose(f);
+        return data;
+    }
+
+    void Block(BlockType_t type, const char *data = NULL, int length = 0) {
+        BodyDataBlock_t block = { type, data, length, sink };
+        file_sink_block(&block);
+    }
+
+    void Part(const char *disposition) {
+        HTTPHeaderField fields[2] = {
+            { "Content-Type", "application/octet-stream", HTTP_HDR_CONTENT_TYPE },
+            { "Content-Disposition", disposition, HTTP_HDR_CONTENT_DISPOSITION },
+        };
+        Block(eSubHeader, (const char *)fields, 2);
+    }
+};
+
+///////////////////////////////////////////////////////////////
+//                     FILE SINK TESTS                       //
+///////////////////////////////////////////////////////////////
+TEST_F(FileSinkTest, StoresFileParts)
+{
+    std::string small("hello world");
+    std::string big(3 * HTTP_UPLOAD_BUFFER + 123, 0);
+    for (size_t i = 0; i < big.size(); i++)
+        big[i] = (char)(i * 7);
+
+    Block(eStart);
+    Part("form-data; name=\"text\"");  // not a file
+    Block(eDataBlock, "ignored", 7);
+    Block(eDataEnd);
+    Part("form-data; name=\"a\"; filename=\"a.txt\"");
+    Block(eDataBlock, small.data(), 5);
+    Block(eDataBlock, small.data() + 5, 6);
+    Block(eDataEnd);
+    Part("form-data; name=\"b\"; filename=\"C:\\\\dir\\\\b.bin\"");
+    // small blocks that fill the buffer, then a block that bypasses it
+    Block(eDataBlock, big.data(), 1000);
+    Block(eDataBlock, big.data() + 1000, HTTP_UPLOAD_BUFFER);
+    Block(eDataBlock, big.data() + 1000 + HTTP_UPLOAD_BUFFER, big.size() - 1000 - HTTP_UPLOAD_BUFFER);
+    Block(eDataEnd);
+    Block(eTerminate);
+
+    ASSERT_EQ(reports.size(), 2u);
+    EXPECT_EQ(report_names[0], "a.txt");
+    EXPECT_EQ(reports[0].size, small.size());
+    EXPECT_EQ(reports[0].error, 0);
+    EXPECT_EQ(report_names[1], "b.bin");
+    EXPECT_EQ(reports[1].size, big.size());
+    EXPECT_EQ(reports[1].error, 0);
+    EXPECT_EQ(Contents("a.txt"), small);
+    EXPECT_TRUE(Contents("b.bin") == big);
+    EXPECT_EQ(Files().size(), 2u); // no temporary files left
+}
+
+TEST_F(FileSinkTest, RawBody)
+{
+    Block(eStart);
+    Block(eDataStart);
+    Block(eDataBlock, "0123456789", 10);
+    Block(eDataEnd);
+    Block(eTerminate);
+
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_EQ(report_names[0], "raw.bin");
+    EXPECT_EQ(Contents("raw.bin"), "0123456789");
+}
+
+TEST_F(FileSinkTest, AbortLeavesNothing)
+{
+    std::string data(HTTP_UPLOAD_BUFFER * 2, 'x');
+
+    Block(eStart);
+    Part("form-data; name=\"a\"; filename=\"partial.bin\"");
+    Block(eDataBlock, data.data(), data.size());
+    Block(eAbort);
+
+    EXPECT_EQ(reports.size(), 0u);
+    EXPECT_EQ(Files().size(), 0u);
+}
+
+TEST_F(FileSinkTest, UnsafeNamesAreSkipped)
+{
+    Block(eStart);
+    Part("form-data; name=\"a\"; filename=\"..\"");
+    Block(eDataBlock, "x", 1);
+    Block(eDataEnd);
+    Part("form-data; name=\"a\"; filename=\".hidden\"");
+    Block(eDataBlock, "x", 1);
+    Block(eDataEnd);
+    Part("form-data; name=\"a\"; filename=\"../../up.txt\"");
+    Block(eDataBlock, "y", 1);
+    Block(eDataEnd);
+    Block(eTerminate);
+
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_EQ(report_names[0], "up.txt");
+    EXPECT_EQ(Contents("up.txt"), "y");
+    EXPECT_EQ(Files().size(), 1u);
+}
+
+TEST_F(FileSinkTest, MissingFolderIsReported)
+{
+    Block(eTerminate);
+    sink = FileSinkCreate("sink_test/missing", "raw.bin", &Report, NULL);
+    Block(eStart);
+    Part("form-data; name=\"a\"; filename=\"a.txt\"");
+    Block(eDataBlock, "x", 1);
+    Block(eDataEnd);
+    Block(eTerminate);
+
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_EQ(reports[0].error, ENOENT);
+}
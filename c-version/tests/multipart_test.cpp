@@ -114,6 +114,7 @@ TEST_F(HttpMultipartTest, MultiPart1)
     }
     // Terminate
     req.BodyCB(req.BodyContext, NULL, 0);
+    resp._buf[resp._index] = 0;
 
     const char *expected = "Start\n"
         "Commando.sid (Size: 4126)\n"
@@ -121,6 +122,7 @@ TEST_F(HttpMultipartTest, MultiPart1)
         "End.\n";
 
     EXPECT_STREQ((const char *)resp._buf, expected);
+    ReleaseReqMessage(&req);
 }
 
 TEST_F(HttpMultipartTest, MultiPart2)
@@ -161,6 +163,7 @@ TEST_F(HttpMultipartTest, MultiPart2)
         "End.\n";
 
     EXPECT_STREQ((const char *)resp._buf, expected);
+    ReleaseReqMessage(&req);
 }
 
 // A connection dropped mid-body delivers a negative length; the absorber must
@@ -186,6 +189,7 @@ TEST_F(HttpMultipartTest, MultiPartAbortMidBody)
 
     EXPECT_NE(strstr((const char *)resp._buf, "Abort.\n"), (const char *)NULL);
     EXPECT_EQ(strstr((const char *)resp._buf, "End.\n"), (const char *)NULL);
+    ReleaseReqMessage(&req);
 }
 
 // A part header longer than the 1024-byte header buffer must be truncated
@@ -224,4 +228,91 @@ TEST_F(HttpMultipartTest, MultiPartOverlongHeader)
     // The over-long header is truncated, so the part parses and the body still
     // terminates without corruption or a crash.
     EXPECT_NE(strstr((const char *)resp._buf, "End.\n"), (const char *)NULL);
+    ReleaseReqMessage(&req);
+}
+
+static std::string collected;
+
+void CollectCB(BodyDataBlock_t *block)
+{
+    switch(block->type) {
+        case eSubHeader:
+            collected += "[";
+            break;
+        case eDataBlock:
+            collected.append(block->data, block->length);
+            break;
+        case eDataEnd:
+            collected += "]";
+            break;
+        case eTerminate:
+            collected += ".";
+            break;
+        default:
+            break;
+    }
+}
+
+// Data that holds partial separators, also overlapping the real one, must be
+// delivered unchanged however the body is split into chunks.
+TEST_F(HttpMultipartTest, MultiPartSeparatorAcrossChunks)
+{
+    std::string data1 = "a\r\n--BOUNDAR\r\n--BOUNDARx\r\r\n--BOUNDAR";
+    std::string data2 = "\r\n-\r\n--\r\n--B";
+    std::string body = "preamble\r\n--BOUNDARY\r\n"
+        "Content-Disposition: form-data; name=\"a\"\r\n\r\n" + data1 +
+        "\r\n--BOUNDARY\r\n\r\n" + data2 +
+        "\r\n--BOUNDARY--\r\nepilogue\r\n--BOUNDARY\r\n";
+    std::string expected = "[" + data1 + "][" + data2 + "].";
+
+    for (int chunk = 1; chunk <= (int)body.size(); chunk++) {
+        HTTPReqMessage req;
+        InitReqMessage(&req);
+        req.ContentType = "multipart/form-data; boundary=\"BOUNDARY\"";
+        collected.clear();
+        setup_multipart(&req, &CollectCB, NULL);
+
+        for (size_t pos = 0; pos < body.size(); pos += chunk) {
+            int send = (int)std::min((size_t)chunk, body.size() - pos);
+            req.BodyCB(req.BodyContext, (const uint8_t *)body.data() + pos, send);
+        }
+        req.BodyCB(req.BodyContext, NULL, 0);
+        EXPECT_EQ(collected, expected) << "chunk size " << chunk;
+        ReleaseReqMessage(&req);
+    }
+}
+
+// The stream stays with the request message: the next upload on the same
+// message (connection) reuses it, including after an aborted one.
+TEST_F(HttpMultipartTest, MultiPartStreamReuse)
+{
+    const char body[] = "--X\r\n\r\nabc\r\n--X--\r\n";
+    HTTPReqMessage req, other;
+
+    collected.clear();
+    InitReqMessage(&req);
+    InitReqMessage(&other);
+    req.ContentType = "multipart/form-data; boundary=X";
+    other.ContentType = req.ContentType;
+    setup_multipart(&req, &CollectCB, NULL);
+    ASSERT_NE(req.BodyContext, (void *)NULL);
+    void *stream = req.BodyContext;
+    setup_multipart(&other, &CollectCB, NULL);
+    EXPECT_NE(other.BodyContext, stream);
+    req.BodyCB(req.BodyContext, (const uint8_t *)body, 4);
+    req.BodyCB(req.BodyContext, NULL, -1);
+
+    ResetReqMessage(&req);
+    req.ContentType = "multipart/form-data; boundary=X";
+    setup_multipart(&req, &CollectCB, NULL);
+    EXPECT_EQ(req.BodyContext, stream);
+    req.BodyCB(req.BodyContext, (const uint8_t *)body, sizeof(body) - 1);
+    req.BodyCB(req.BodyContext, NULL, 0);
+    other.BodyCB(other.BodyContext, (const uint8_t *)body, sizeof(body) - 1);
+    other.BodyCB(other.BodyContext, NULL, 0);
+    EXPECT_EQ(collected, "[abc].[abc].");
+
+    ReleaseReqMessage(&req);
+    ReleaseReqMessage(&other);
+    EXPECT_EQ(req._multipart, (void *)NULL);
 }
@@ -255,3 +255,336 @@ TEST_F(HttpProtocolTest, Post_ZeroContentLength_NoBody)
     EXPECT_EQ(ret, WRITING_SOCKET);
     EXPECT_EQ(last, -1);
 }
+
+// HTTP/1.1 requests are persistent by default; "Connection: close" and the
+// HTTP/1.0 default turn that off, "Connection: keep-alive" turns it on. Only
+// whole tokens of the comma separated list count.
+TEST_F(HttpProtocolTest, KeepAlive_ConnectionHeader)
+{
+    const char *raw[] = {
+        "GET /a HTTP/1.1\r\nHost: x\r\n\r\n",
+        "GET /a HTTP/1.1\r\nConnection: close\r\n\r\n",
+        "GET /a HTTP/1.0\r\nHost: x\r\n\r\n",
+        "GET /a HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n",
+        "GET /a HTTP/1.1\r\nConnection: foo, close\r\n\r\n",
+        "GET /a HTTP/1.1\r\nConnection: closed-foo, x-close-after\r\n\r\n", // only inside longer tokens
+        "GET /a HTTP/1.0\r\nConnection: not-keep-alive\r\n\r\n",
+        "GET /a HTTP/1.0\r\nConnection: upgrade ,\tkeep-alive \r\n\r\n",
+    };
+    int expected[] = { 1, 0, 0, 1, 0, 1, 0, 1 };
+
+    for (int i = 0; i < 8; i++) {
+        HTTPReqMessage req;
+        HTTPRespMessage resp;
+        InitReqMessage(&req);
+        InitRespMessage(&resp);
+
+        int len = (int)strlen(raw[i]);
+        FillBuffer(req, readsize, (uint8_t *)raw[i], len);
+        EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+        EXPECT_EQ(req.KeepAlive, expected[i]) << raw[i];
+    }
+}
+
+// ResetReqMessage keeps the request count, so the last request allowed on a
+// connection is no longer persistent.
+TEST_F(HttpProtocolTest, KeepAlive_MaxRequests)
+{
+    const char raw[] = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n";
+    int len = (int)sizeof(raw) - 1;
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+
+    for (int i = 1; i <= HTTP_MAX_KEEPALIVE_REQUESTS; i++) {
+        FillBuffer(req, readsize, (uint8_t *)raw, len);
+        EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+        EXPECT_EQ(req.KeepAlive, (i < HTTP_MAX_KEEPALIVE_REQUESTS) ? 1 : 0);
+        ResetReqMessage(&req);
+    }
+}
+
+// Pipelining: bytes that follow a complete request stay in the buffer and are
+// parsed as the next request after ResetReqMessage, including after a chunked
+// body with its terminating empty line.
+TEST_F(HttpProtocolTest, Pipelined_Requests)
+{
+    const char raw[] =
+        "GET /first HTTP/1.1\r\nHost: x\r\n\r\n"
+        "POST /second HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n0\r\n\r\n"
+        "GET /third HTTP/1.1\r\nHost: x\r\n\r\n";
+    int len = (int)sizeof(raw) - 1;
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+
+    EXPECT_EQ(FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)raw, len), len);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_STREQ(req.Header.URI, "/first");
+
+    ResetReqMessage(&req);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_STREQ(req.Header.URI, "/second");
+    EXPECT_EQ(total, 5);
+
+    ResetReqMessage(&req);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_STREQ(req.Header.URI, "/third");
+    EXPECT_EQ(req._valid - req._used, 0);
+    EXPECT_EQ(req._requests, 3);
+}
+
+// HEAD is recognized (static files answer it without a body), and response
+// dates use the IMF-fixdate format independent of the locale.
+TEST_F(HttpProtocolTest, HeadMethodAndDate)
+{
+    const char raw[] = "HEAD /index.html HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n";
+    int len = (int)sizeof(raw) - 1;
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+
+    EXPECT_EQ(FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)raw, len), len);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.Method, HTTP_HEAD);
+    EXPECT_STREQ(GetReqHeader(&req, "accept-encoding"), "gzip");
+    EXPECT_EQ(GetReqHeader(&req, "Range"), (const char *)NULL);
+
+    char date[HTTP_DATE_SIZE];
+    EXPECT_EQ(HTTPFormatDate(date, 784111777), 29);
+    EXPECT_STREQ(date, "Sun, 06 Nov 1994 08:49:37 GMT");
+}
+
+// Conditional requests compare If-Modified-Since against the file time; all
+// three date formats of RFC 9110 must be accepted.
+TEST_F(HttpProtocolTest, ParseDate)
+{
+    EXPECT_EQ(HTTPParseDate("Sun, 06 Nov 1994 08:49:37 GMT"), 784111777);
+    EXPECT_EQ(HTTPParseDate("Sunday, 06-Nov-94 08:49:37 GMT"), 784111777);
+    EXPECT_EQ(HTTPParseDate("Sun Nov  6 08:49:37 1994"), 784111777);
+    EXPECT_EQ(HTTPParseDate("Thu, 01 Jan 1970 00:00:00 GMT"), 0);
+    EXPECT_EQ(HTTPParseDate("Tue, 29 Feb 2028 23:59:59 GMT"), 1835481599);
+    EXPECT_EQ(HTTPParseDate("yesterday"), (time_t)-1);
+    EXPECT_EQ(HTTPParseDate("Sun, 06 Foo 1994 08:49:37 GMT"), (time_t)-1);
+}
+
+// The LF scanner must find the first LF at any offset, on either side of the
+// vector widths, and never read past the end.
+TEST_F(HttpProtocolTest, ScanLF)
+{
+    char buf[100];
+    memset(buf, 'a', sizeof(buf));
+    EXPECT_EQ(HTTPScanLF(buf, buf + sizeof(buf)), (const char *)NULL);
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        buf[i] = '\n';
+        buf[sizeof(buf) - 1] = '\n';
+        EXPECT_EQ(HTTPScanLF(buf, buf + sizeof(buf)), buf + i);
+        EXPECT_EQ(HTTPScanLF(buf + 1, buf + i), (const char *)NULL);
+        buf[i] = 'a';
+    }
+}
+
+// A header that trickles in one byte at a time is found exactly once, at its
+// end, and the bytes that follow are left for the body.
+TEST_F(HttpProtocolTest, HeaderByteByByte)
+{
+    const char raw[] =
+        "POST /upload HTTP/1.1\r\nHost: x\r\nX-Bare: a\nb\r\nContent-Length: 3\r\n\r\nabc";
+    int len = (int)sizeof(raw) - 1;
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+
+    int i;
+    for (i = 0; i < len; i++) {
+        FillBuffer(req, 1, (uint8_t *)raw + i, len - i);
+        uint8_t state = ProcessClientData(&req, &resp, &callback);
+        if (state == WRITING_SOCKET)
+            break;
+        EXPECT_EQ(state, READING_SOCKET);
+    }
+    EXPECT_EQ(i, len - 1);
+    EXPECT_STREQ(req.Header.URI, "/upload");
+    EXPECT_EQ(req.Header.FieldCount, 3u);
+    EXPECT_EQ(total, 3);
+}
+
+// A header that fits in the receive buffer is parsed where it was received;
+// when a body follows, it is moved to Header._buffer before the body overwrites
+// the receive buffer. A header larger than the receive buffer is collected in
+// Header._buffer.
+TEST_F(HttpProtocolTest, HeaderParsedInPlace)
+{
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    const char get[] = "GET /in/place HTTP/1.1\r\nHost:  x \r\n\r\n";
+
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+    FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)get, sizeof(get) - 1);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.URI, (const char *)req._buf + 4);
+    EXPECT_STREQ(GetReqHeader(&req, "host"), "x");
+
+    const char post[] = "POST /p HTTP/1.1\r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nbody";
+    InitReqMessage(&req);
+    FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)post, sizeof(post) - 1);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(total, 4);
+    EXPECT_EQ(req.Header.URI, (const char *)req.Header._buffer + 5);
+    EXPECT_STREQ(req.ContentType, "text/plain");
+
+    std::string big = "GET /big HTTP/1.1\r\nX-Filler: " + std::string(1500, 'f') + "\r\nHost: y\r\n\r\n";
+    InitReqMessage(&req);
+    int done = 0;
+    uint8_t state = READING_SOCKET;
+    while ((state == READING_SOCKET) && (done < (int)big.size())) {
+        done += FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)big.data() + done, big.size() - done);
+        state = ProcessClientData(&req, &resp, &callback);
+    }
+    EXPECT_EQ(state, WRITING_SOCKET);
+    EXPECT_STREQ(req.Header.URI, "/big");
+    EXPECT_STREQ(GetReqHeader(&req, "Host"), "y");
+    EXPECT_EQ(strlen(GetReqHeader(&req, "X-Filler")), 1500u);
+}
+
+// Known header names map to their ID in any letter case; other names, even
+// with the same length and first and last letter, do not.
+TEST_F(HttpProtocolTest, HeaderIds)
+{
+    EXPECT_EQ(HTTPHeaderLookup("Content-Length", 14), HTTP_HDR_CONTENT_LENGTH);
+    EXPECT_EQ(HTTPHeaderLookup("IF-NONE-MATCH", 13), HTTP_HDR_IF_NONE_MATCH);
+    EXPECT_EQ(HTTPHeaderLookup("te", 2), HTTP_HDR_TE);
+    EXPECT_EQ(HTTPHeaderLookup("x-requested-with", 16), HTTP_HDR_X_REQUESTED_WITH);
+    EXPECT_EQ(HTTPHeaderLookup("content-lenxth", 14), HTTP_HDR_UNKNOWN);
+    EXPECT_EQ(HTTPHeaderLookup("X-Custom", 8), HTTP_HDR_UNKNOWN);
+    EXPECT_EQ(HTTPHeaderLookup("", 0), HTTP_HDR_UNKNOWN);
+    EXPECT_EQ(HTTPHeaderLookup("1-2", 3), HTTP_HDR_UNKNOWN);
+
+    // Known fields are found by ID even when Fields[] is full.
+    std::string raw = "GET / HTTP/1.1\r\n";
+    for (int i = 0; i < MAX_HEADER_FIELDS; i++)
+        raw += "X-Filler-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+    raw += "Range: bytes=0-1\r\nrange: ignored\r\n\r\n";
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+    FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)raw.data(), raw.size());
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.FieldCount, (unsigned int)MAX_HEADER_FIELDS);
+    EXPECT_STREQ(GetReqHeaderById(&req, HTTP_HDR_RANGE), "bytes=0-1");
+    EXPECT_STREQ(GetReqHeader(&req, "RANGE"), "bytes=0-1");
+    EXPECT_EQ(GetReqHeaderById(&req, HTTP_HDR_HOST), (const char *)NULL);
+    EXPECT_STREQ(GetReqHeader(&req, "x-filler-3"), "3");
+}
+
+// Unknown names that are longer than the name in their hash slot are rejected
+// by length, without reading past the known name.
+TEST_F(HttpProtocolTest, HeaderIdsLongUnknownNames)
+{
+    const char *names[] = {
+        "Sec-WebSocket-Extensions",   // slot of accept-language
+        "X-Correlation-Identifier",   // slot of expect
+        "Upgrade-Insecure-Requests", "Content-Security-Policy", "Accept-Datetime",
+        "Strict-Transport-Security", "Access-Control-Request-Headers",
+    };
+    for (const char *name : names) {
+        std::string copy(name); // passed by length, as the parser does
+        EXPECT_EQ(HTTPHeaderLookup(copy.data(), copy.size()), HTTP_HDR_UNKNOWN) << name;
+    }
+
+    std::string raw = "GET / HTTP/1.1\r\nSec-WebSocket-Extensions: a\r\nUpgrade-Insecure-Requests: 1\r\n"
+        "Accept-Language: nl\r\n\r\n";
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+    FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)raw.data(), raw.size());
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_STREQ(GetReqHeaderById(&req, HTTP_HDR_ACCEPT_LANGUAGE), "nl");
+    EXPECT_STREQ(GetReqHeader(&req, "Sec-WebSocket-Extensions"), "a");
+    EXPECT_STREQ(GetReqHeader(&req, "Upgrade-Insecure-Requests"), "1");
+}
+
+// Every RFC 9110 method (and PATCH) is recognized; anything else, including a
+// lower case or truncated method, is HTTP_UNKNOWN instead of GET.
+TEST_F(HttpProtocolTest, Methods)
+{
+    EXPECT_EQ(HaveMethod("GET", 3), HTTP_GET);
+    EXPECT_EQ(HaveMethod("HEAD", 4), HTTP_HEAD);
+    EXPECT_EQ(HaveMethod("POST", 4), HTTP_POST);
+    EXPECT_EQ(HaveMethod("PUT", 3), HTTP_PUT);
+    EXPECT_EQ(HaveMethod("DELETE", 6), HTTP_DELETE);
+    EXPECT_EQ(HaveMethod("CONNECT", 7), HTTP_CONNECT);
+    EXPECT_EQ(HaveMethod("OPTIONS", 7), HTTP_OPTIONS);
+    EXPECT_EQ(HaveMethod("TRACE", 5), HTTP_TRACE);
+    EXPECT_EQ(HaveMethod("PATCH", 5), HTTP_PATCH);
+    EXPECT_EQ(HaveMethod("get", 3), HTTP_UNKNOWN);
+    EXPECT_EQ(HaveMethod("GETS", 4), HTTP_UNKNOWN);
+    EXPECT_EQ(HaveMethod("PROPFIND", 8), HTTP_UNKNOWN);
+    EXPECT_EQ(HaveMethod("", 0), HTTP_UNKNOWN);
+}
+
+// A PUT body is framed like a POST body, and so is a body sent with a GET,
+// rather than being read as the next request.
+TEST_F(HttpProtocolTest, BodyFramingForAnyMethod)
+{
+    const char raw[] =
+        "PUT /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+        "GET /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nxy"
+        "DELETE /c HTTP/1.1\r\n\r\n";
+    int len = (int)sizeof(raw) - 1;
+
+    HTTPReqMessage req;
+    HTTPRespMessage resp;
+    InitReqMessage(&req);
+    InitRespMessage(&resp);
+    EXPECT_EQ(FillBuffer(req, HTTP_BUFFER_SIZE, (uint8_t *)raw, len), len);
+
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.Method, HTTP_PUT);
+    EXPECT_EQ(total, 3);
+    ResetReqMessage(&req);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.Method, HTTP_GET);
+    EXPECT_EQ(total, 2);
+    ResetReqMessage(&req);
+    EXPECT_EQ(ProcessClientData(&req, &resp, &callback), WRITING_SOCKET);
+    EXPECT_EQ(req.Header.Method, HTTP_DELETE);
+    EXPECT_EQ(req.bodyType, eNoBody);
+    EXPECT_TRUE(req.KeepAlive);
+}
+
+TEST_F(HttpProtocolTest, RespAppend)
+{
+    static const char text[] = "0123456789";
+    HTTPRespMessage resp;
+    InitRespMessage(&resp);
+
+    EXPECT_EQ(HTTPRespAppend(&resp, text, 0), 0); // nothing to queue
+    EXPECT_EQ(resp._segment_count, 0);
+    EXPECT_EQ(HTTPRespAppend(&resp, text, 3), 0);
+    EXPECT_EQ(HTTPRespAppend(&resp, text + 3, 4), 0); // continues the previous piece
+    EXPECT_EQ(resp._segment_count, 1);
+    EXPECT_EQ(resp._segments[0].length, 7u);
+    for (int i = 1; i < HTTP_RESP_SEGMENTS; i++)
+        EXPECT_EQ(HTTPRespAppend(&resp, text + ((i & 1) ? 1 : 5), 1), 0);
+    EXPECT_EQ(resp._segment_count, HTTP_RESP_SEGMENTS);
+    EXPECT_EQ(HTTPRespAppend(&resp, "x", 1), -1);
+    EXPECT_EQ((const char *)resp._segments[1].data, text + 1);
+
+    InitRespMessage(&resp);
+    EXPECT_EQ(resp._segment_count, 0);
+    EXPECT_EQ(resp._segment_sent, 0);
+}
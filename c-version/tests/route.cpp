@@ -2,6 +2,7 @@
 #include <string>
 #include <gtest/gtest.h>
 #include <stdio.h>
+#include <vector>
 
 #include "../lib/url.h"
 
@@ -141,6 +142,113 @@ TEST_F(RouteTest, ParseUrl_UnsupportedApiVersion) {
     EXPECT_EQ(nullptr, c);
 }
 
+TEST_F(RouteTest, ParseUrlArena_RoutePathCommandParameters) {
+    char buffer[256];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    UrlComponents c;
+    const char url[] = "/v1/files/some/path/to/disk.d64:createDiskImage?type=d64&format=json&name=a%20b";
+
+    ASSERT_EQ(0, parse_url_arena(url, &c, &arena));
+    MakeComponentParts(&c);
+
+    EXPECT_EQ("v1", apiversion);
+    EXPECT_EQ("files", route);
+    EXPECT_EQ("some/path/to/disk.d64", path);
+    EXPECT_EQ("createDiskImage", command);
+    EXPECT_EQ("type=d64&format=json&name=a%20b", querystring);
+    ASSERT_EQ(3u, c.parameters_len);
+    EXPECT_EQ("type", std::string(c.parameters[0].name));
+    EXPECT_EQ("d64", std::string(c.parameters[0].value));
+    EXPECT_EQ("format", std::string(c.parameters[1].name));
+    EXPECT_EQ("json", std::string(c.parameters[1].value));
+    EXPECT_EQ("name", std::string(c.parameters[2].name));
+    EXPECT_EQ("a b", std::string(url_parameter_value(&c, 2)));
+    EXPECT_EQ(0u, ((uintptr_t)c.parameters) % sizeof(void *));
+    EXPECT_LE(arena.used, sizeof(buffer));
+    // everything lives in the arena; the url itself is untouched
+    EXPECT_TRUE(c.route >= buffer && c.route < buffer + arena.used);
+    EXPECT_TRUE((const char *)c.parameters >= buffer && (const char *)c.parameters < buffer + arena.used);
+    EXPECT_EQ("/v1/files/some/path/to/disk.d64:createDiskImage?type=d64&format=json&name=a%20b", std::string(url));
+}
+
+TEST_F(RouteTest, ParseUrl_DecodedParameters) {
+    UrlComponents *c;
+
+    // parse_url() hands out decoded values, to be read directly
+    c = parse_url("/v1/search?query=%28name%3A%22a+b%22%29&type=d64&empty=&flag");
+    ASSERT_NE(nullptr, c);
+    ASSERT_EQ(4u, c->parameters_len);
+    EXPECT_EQ("query", std::string(c->parameters[0].name));
+    EXPECT_EQ("(name:\"a b\")", std::string(c->parameters[0].value));
+    EXPECT_EQ(0, c->parameters[0].encoded);
+    EXPECT_EQ("d64", std::string(c->parameters[1].value));
+    EXPECT_EQ("", std::string(c->parameters[2].value));
+    EXPECT_EQ("flag", std::string(c->parameters[3].name));
+    EXPECT_EQ("", std::string(c->parameters[3].value));
+    EXPECT_EQ("(name:\"a b\")", std::string(url_parameter(c, "query")));
+
+    delete_url_components(c);
+}
+
+TEST_F(RouteTest, ParseUrlArena_LazyParameters) {
+    char buffer[256];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    UrlComponents comp;
+    UrlComponents *c = &comp;
+
+    ASSERT_EQ(0, parse_url_arena("/v1/search?query=%28name%3A%22a+b%22%29&type=d64&empty=&flag", c, &arena));
+    ASSERT_EQ(4u, c->parameters_len);
+
+    // values stay encoded until they are asked for
+    EXPECT_EQ("%28name%3A%22a+b%22%29", std::string(c->parameters[0].value));
+    EXPECT_EQ(1, c->parameters[0].encoded);
+    EXPECT_EQ("(name:\"a b\")", std::string(url_parameter(c, "query")));
+    EXPECT_EQ(0, c->parameters[0].encoded);
+    EXPECT_EQ("(name:\"a b\")", std::string(url_parameter(c, "query"))); // cached
+    EXPECT_EQ("d64", std::string(url_parameter(c, "type")));
+    EXPECT_EQ("", std::string(url_parameter(c, "empty")));
+    EXPECT_EQ("", std::string(url_parameter(c, "flag")));
+    EXPECT_EQ(nullptr, url_parameter(c, "missing"));
+    EXPECT_EQ(nullptr, url_parameter_value(c, 4));
+    EXPECT_EQ("query=%28name%3A%22a+b%22%29&type=d64&empty=&flag", std::string(c->querystring));
+}
+
+TEST_F(RouteTest, ParseUrlArena_NoQuerystring) {
+    char buffer[64];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    UrlComponents c;
+
+    ASSERT_EQ(0, parse_url_arena("/v1/files", &c, &arena));
+    EXPECT_EQ("files", std::string(c.route));
+    EXPECT_EQ("none", std::string(c.command));
+    EXPECT_EQ(0u, c.parameters_len);
+    EXPECT_EQ(nullptr, c.parameters);
+
+    EXPECT_EQ(-1, parse_url_arena("/v64/route?querystring", &c, &arena));
+}
+
+TEST_F(RouteTest, ParseUrlArena_BoundedParameters) {
+    char buffer[1024];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    UrlComponents c;
+    std::string url = "/v1/route?p0=0";
+    for (int i = 1; i < URL_MAX_PARAMETERS + 4; i++)
+        url += "&p" + std::to_string(i) + "=" + std::to_string(i);
+
+    ASSERT_EQ(0, parse_url_arena(url.c_str(), &c, &arena));
+    ASSERT_EQ((size_t)URL_MAX_PARAMETERS, c.parameters_len);
+    EXPECT_EQ(std::to_string(URL_MAX_PARAMETERS - 1), std::string(c.parameters[URL_MAX_PARAMETERS - 1].value));
+}
+
+TEST_F(RouteTest, ParseUrlArena_TooSmall) {
+    char buffer[24];
+    UrlArena arena = { buffer, sizeof(buffer), 0 };
+    UrlComponents c;
+
+    EXPECT_EQ(-1, parse_url_arena("/v1/route/a/long/path?querystring=value", &c, &arena));
+    EXPECT_LE(arena.used, sizeof(buffer));
+}
+
 ///////////////////////////////////////////////////////////////
 //                  URL DECODE TESTS                         //
 ///////////////////////////////////////////////////////////////
@@ -176,6 +284,44 @@ TEST_F(RouteTest, UrlDecode_NonHexAfterPercent_CopiedLiterally) {
     EXPECT_EQ("a%zz", std::string(out));
 }
 
+TEST_F(RouteTest, UrlDecode_Max) {
+    char in[] = "a%20bcd";
+    char out[4];
+    url_decode(in, out, sizeof(out));
+    EXPECT_EQ("a b", std::string(out));
+}
+
+TEST_F(RouteTest, UrlDecode_LongStrings) {
+    // Runs of all lengths around the vector widths, compared to a byte-wise decode.
+    const char *pieces[] = { "abcdefghijklmnopqrstuvwxyz0123456789", "%41", "+", "%", "%4", "%zz", "%7e" };
+    srand(1);
+    for (int n = 0; n < 500; n++) {
+        std::string in, expected;
+        int count = rand() % 12;
+        for (int i = 0; i < count; i++) {
+            int k = rand() % 7;
+            std::string piece = pieces[k];
+            if (k == 0)
+                piece = piece.substr(0, rand() % piece.size());
+            in += piece;
+        }
+        for (size_t i = 0; i < in.size(); i++) {
+            if (in[i] == '+') {
+                expected += ' ';
+            } else if ((in[i] == '%') && (i + 2 < in.size()) && isxdigit(in[i + 1]) && isxdigit(in[i + 2])) {
+                expected += (char)strtoul(in.substr(i + 1, 2).c_str(), NULL, 16);
+                i += 2;
+            } else {
+                expected += in[i];
+            }
+        }
+        std::vector<char> buf(in.begin(), in.end());
+        buf.push_back(0);
+        url_decode(buf.data(), buf.data(), 0); // in place
+        EXPECT_EQ(expected, std::string(buf.data())) << in;
+    }
+}
+
 ///////////////////////////////////////////////////////////////
 //                  QUERYSTRING TESTS                        //
 ///////////////////////////////////////////////////////////////
@@ -267,3 +413,22 @@ TEST_F(RouteTest, ParseQS_Groetjes) {
 
     free(parameters);
 }
+
+TEST_F(RouteTest, ParseQS_Long) {
+    std::string q;
+    for (int i = 0; i < 100; i++)
+        q += "name" + std::to_string(i) + "=value%20" + std::to_string(i) + "&";
+    q += "last";
+    std::vector<char> buf(q.begin(), q.end());
+    buf.push_back(0);
+
+    parameters = parse_querystring(buf.data(), &len);
+
+    ASSERT_EQ(101u, len);
+    EXPECT_EQ("name57", std::string(parameters[57].name));
+    EXPECT_EQ("value 57", std::string(parameters[57].value));
+    EXPECT_EQ("last", std::string(parameters[100].name));
+    EXPECT_EQ("", std::string(parameters[100].value));
+
+    free(parameters);
+}
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include "../lib/route_table.h"
+#include "../lib/dummy_api.h"
+
+static void HandlerA(RouteMatch *match, HTTPReqMessage *req, HTTPRespMessage *res) { }
+static void HandlerB(RouteMatch *match, HTTPReqMessage *req, HTTPRespMessage *res) { }
+static void HandlerC(RouteMatch *match, HTTPReqMessage *req, HTTPRespMessage *res) { }
+
+class RouteTableTest : public ::testing::Test {
+protected:
+    // SetUp and TearDown executes for each test case.
+    void SetUp() override {
+        RouteTableClear();
+    }
+
+    void TearDown() override {
+        RouteTableClear();
+    }
+
+    // Class members are accessible from test cases. Reinitiated before each test.
+    char buffer[512];
+    UrlArena arena;
+    RouteMatch match;
+
+    ROUTE_HANDLER Find(HTTPMethod method, const char *uri) {
+        arena = { buffer, sizeof(buffer), 0 };
+        return RouteTableFind(method, uri, &arena, &match);
+    }
+
+    std::string Param(size_t i) {
+        if (i >= match.params_len)
+            return "<none>";
+        return std::string(match.params[i].name) + "=" + match.params[i].value;
+    }
+};
+
+///////////////////////////////////////////////////////////////
+//                  ROUTE TABLE TESTS                        //
+///////////////////////////////////////////////////////////////
+TEST_F(RouteTableTest, LiteralRoutesShareTheirPrefix)
+{
+    int ctx_a, ctx_b;
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/drives", &HandlerA, &ctx_a));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/drives:info", &HandlerB, &ctx_b));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/dr", &HandlerC, NULL)); // splits the edge again
+
+    EXPECT_EQ(&HandlerA, Find(HTTP_GET, "/v1/drives"));
+    EXPECT_EQ(&ctx_a, match.context);
+    EXPECT_EQ(0u, match.params_len);
+    EXPECT_EQ(&HandlerB, Find(HTTP_GET, "/v1/drives:info?verbose=1"));
+    EXPECT_EQ(&ctx_b, match.context);
+    EXPECT_EQ(&HandlerC, Find(HTTP_GET, "/v1/dr"));
+    EXPECT_EQ(nullptr, Find(HTTP_GET, "/v1/d"));
+    EXPECT_EQ(nullptr, Find(HTTP_GET, "/v1/drivesx"));
+    EXPECT_EQ(nullptr, Find(HTTP_GET, "/v2/drives"));
+}
+
+TEST_F(RouteTableTest, Methods)
+{
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/files", &HandlerA, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_PUT, "/v1/files", &HandlerB, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_UNKNOWN, "/v1/any", &HandlerC, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/files", &HandlerC, NULL)); // taken
+
+    EXPECT_EQ(&HandlerA, Find(HTTP_GET, "/v1/files"));
+    EXPECT_EQ(&HandlerB, Find(HTTP_PUT, "/v1/files"));
+    EXPECT_EQ(nullptr, Find(HTTP_DELETE, "/v1/files"));
+    EXPECT_EQ(&HandlerC, Find(HTTP_DELETE, "/v1/any"));
+    EXPECT_EQ(&HandlerC, Find(HTTP_POST, "/v1/any"));
+}
+
+TEST_F(RouteTableTest, Captures)
+{
+    ASSERT_EQ(0, RouteTableAdd(HTTP_PUT, "/v1/drives/{drive}:mount", &HandlerA, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/drives/{drive}/{item}", &HandlerB, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/files/{path*}:info", &HandlerC, NULL));
+
+    EXPECT_EQ(&HandlerA, Find(HTTP_PUT, "/v1/drives/a:mount?image=x.d64"));
+    EXPECT_EQ(1u, match.params_len);
+    EXPECT_EQ("drive=a", Param(0));
+
+    EXPECT_EQ(&HandlerB, Find(HTTP_GET, "/v1/drives/b/status"));
+    EXPECT_EQ(2u, match.params_len);
+    EXPECT_EQ("drive=b", Param(0));
+    EXPECT_EQ("item=status", Param(1));
+
+    EXPECT_EQ(&HandlerC, Find(HTTP_GET, "/v1/files/some/path%20x/disk.d64:info"));
+    EXPECT_EQ(1u, match.params_len);
+    EXPECT_EQ("path=some/path x/disk.d64", Param(0));
+    EXPECT_EQ(&HandlerC, Find(HTTP_GET, "/v1/files/a:b:info")); // ':' inside the path
+    EXPECT_EQ("path=a:b", Param(0));
+
+    EXPECT_EQ(nullptr, Find(HTTP_PUT, "/v1/drives/:mount")); // empty segment
+    EXPECT_EQ(nullptr, Find(HTTP_GET, "/v1/drives/b/status/more"));
+    EXPECT_EQ(nullptr, Find(HTTP_GET, "/v1/files/a"));
+}
+
+TEST_F(RouteTableTest, QuerystringAndParams)
+{
+    ASSERT_EQ(0, RouteTableAdd(HTTP_PUT, "/v1/drives/{drive}:{command}", &HandlerA, NULL));
+
+    EXPECT_EQ(&HandlerA, Find(HTTP_PUT, "/v1/drives/a:mount?image=x%20y.d64&mode=ro"));
+    EXPECT_STREQ("a", RouteTableParam(&match, "drive"));
+    EXPECT_STREQ("mount", RouteTableParam(&match, "command"));
+    EXPECT_EQ(nullptr, RouteTableParam(&match, "path"));
+    EXPECT_EQ(HTTP_PUT, match.url.method);
+    EXPECT_STREQ("image=x%20y.d64&mode=ro", match.url.querystring);
+    ASSERT_EQ(2u, match.url.parameters_len);
+    EXPECT_STREQ("x y.d64", url_parameter(&match.url, "image"));
+    EXPECT_STREQ("ro", url_parameter(&match.url, "mode"));
+
+    EXPECT_EQ(&HandlerA, Find(HTTP_PUT, "/v1/drives/b:unmount"));
+    EXPECT_STREQ("", match.url.querystring);
+    EXPECT_EQ(0u, match.url.parameters_len);
+
+    char small[8];
+    arena = { small, sizeof(small), 0 };
+    EXPECT_EQ(nullptr, RouteTableFind(HTTP_PUT, "/v1/drives/a:mount?image=x.d64", &arena, &match));
+}
+
+TEST_F(RouteTableTest, LiteralBeforeCapture)
+{
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/{route*}", &HandlerA, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/{route}:version", &HandlerB, NULL));
+    ASSERT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/info:version", &HandlerC, NULL));
+
+    EXPECT_EQ(&HandlerC, Find(HTTP_GET, "/v1/info:version"));
+    EXPECT_EQ(&HandlerB, Find(HTTP_GET, "/v1/files:version"));
+    EXPECT_EQ("route=files", Param(0));
+    EXPECT_EQ(&HandlerA, Find(HTTP_GET, "/v1/files/x:other"));
+    EXPECT_EQ("route=files/x:other", Param(0));
+    EXPECT_EQ(&HandlerA, Find(HTTP_GET, "/v1/info:versions")); // backtracks to the capture
+    EXPECT_EQ(1u, match.params_len);
+}
+
+TEST_F(RouteTableTest, MalformedPatterns)
+{
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{name", &HandlerA, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{}", &HandlerA, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{*}", &HandlerA, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{a*}/x", &HandlerA, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{a}{b}", &HandlerA, NULL));
+    EXPECT_EQ(0, RouteTableAdd(HTTP_GET, "/v1/{a}", &HandlerA, NULL));
+    EXPECT_EQ(-1, RouteTableAdd(HTTP_GET, "/v1/{b}/x", &HandlerA, NULL)); // same place, other name
+}
+
+TEST_F(RouteTableTest, ManyRoutes)
+{
+    char pattern[64], uri[64];
+    for (int i = 0; i < 500; i++) {
+        sprintf(pattern, "/v1/route%d/{id}:cmd%d", i, i % 7);
+        ASSERT_EQ(0, RouteTableAdd(HTTP_GET, pattern, (i & 1) ? &HandlerA : &HandlerB, (void *)(intptr_t)i));
+    }
+    for (int i = 0; i < 500; i++) {
+        sprintf(uri, "/v1/route%d/x%d:cmd%d", i, i, i % 7);
+        ASSERT_EQ((i & 1) ? &HandlerA : &HandlerB, Find(HTTP_GET, uri)) << uri;
+        EXPECT_EQ((intptr_t)i, (intptr_t)match.context);
+        EXPECT_EQ("id=x" + std::to_string(i), Param(0));
+    }
+}
+
+// The API routes split a url like parse_url(): the command is all that follows
+// the first ':'.
+TEST_F(RouteTableTest, ApiRoutes)
+{
+    ApiInit();
+    auto split = [this](const char *uri) -> std::string {
+        if (!Find(HTTP_GET, uri))
+            return "<no route>";
+        const char *path = RouteTableParam(&match, "path");
+        const char *command = RouteTableParam(&match, "command");
+        return std::string(RouteTableParam(&match, "route")) + "|" + (path ? path : "") + "|" +
+            (command ? command : "none");
+    };
+
+    EXPECT_EQ("files||none", split("/v1/files"));
+    EXPECT_EQ("files||none", split("/v1/files/"));
+    EXPECT_EQ("files||none", split("/v1/files:"));
+    EXPECT_EQ("files||info", split("/v1/files:info?x=1"));
+    EXPECT_EQ("files|a/b c|info", split("/v1/files/a/b%20c:info"));
+    EXPECT_EQ("r||cmd/x", split("/v1/r:cmd/x"));
+    EXPECT_EQ("r|a|b:c", split("/v1/r/a:b:c"));
+    EXPECT_EQ("r||cmd", split("/v1/r/:cmd"));
+    EXPECT_EQ("<no route>", split("/v2/files"));
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <string>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "../lib/static_cache.h"
+
+class StaticCacheTest : public ::testing::Test {
+protected:
+    // SetUp and TearDown executes for each test case.
+    void SetUp() override {
+        StaticCacheFlush();
+    }
+
+    void TearDown() override {
+        StaticCacheFlush();
+    }
+
+    // Class members are accessible from test cases. Reinitiated before each test.
+    void WriteFile(const char *path, size_t size, char fill, time_t mtime) {
+        std::string data(size, fill);
+        FILE *f = fopen(path, "wb");
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+        struct utimbuf t = { mtime, mtime };
+        utime(path, &t);
+    }
+};
+
+///////////////////////////////////////////////////////////////
+//                  STATIC CACHE TESTS                       //
+///////////////////////////////////////////////////////////////
+TEST_F(StaticCacheTest, HitReturnsSameEntry)
+{
+    WriteFile("cache_a.html", 100, 'a', 1000);
+
+    StaticCacheEntry *e1 = StaticCacheLookup("cache_a.html", "text/html", NULL, NULL);
+    ASSERT_NE(e1, (StaticCacheEntry *)NULL);
+    EXPECT_EQ(e1->length, 100u);
+    EXPECT_EQ(e1->body[99], 'a');
+    EXPECT_STREQ(e1->etag, "\"3e8-64\"");
+    EXPECT_EQ(std::string(e1->header, e1->header_length),
+        "Content-Type: text/html\r\nContent-Length: 100\r\n"
+        "Last-Modified: Thu, 01 Jan 1970 00:16:40 GMT\r\nETag: \"3e8-64\"\r\n");
+
+    StaticCacheEntry *e2 = StaticCacheLookup("cache_a.html", "text/html", NULL, NULL);
+    EXPECT_EQ(e1, e2);
+    StaticCacheRelease(e1);
+    StaticCacheRelease(e2);
+    remove("cache_a.html");
+}
+
+TEST_F(StaticCacheTest, ChangedFileIsReloaded)
+{
+    WriteFile("cache_b.html", 100, 'a', 1000);
+    StaticCacheEntry *e1 = StaticCacheLookup("cache_b.html", "text/html", NULL, NULL);
+    ASSERT_NE(e1, (StaticCacheEntry *)NULL);
+
+    // The response still sending the old entry keeps it alive.
+    WriteFile("cache_b.html", 50, 'b', 2000);
+    StaticCacheEntry *e2 = StaticCacheLookup("cache_b.html", "text/html", NULL, NULL);
+    ASSERT_NE(e2, (StaticCacheEntry *)NULL);
+    EXPECT_EQ(e2->length, 50u);
+    EXPECT_EQ(e2->body[0], 'b');
+    EXPECT_EQ(e1->length, 100u);
+    EXPECT_EQ(e1->body[0], 'a');
+    StaticCacheRelease(e1);
+    StaticCacheRelease(e2);
+
+    remove("cache_b.html");
+    EXPECT_EQ(StaticCacheLookup("cache_b.html", "text/html", NULL, NULL), (StaticCacheEntry *)NULL);
+    EXPECT_EQ(StaticCacheUsage(), 0u);
+}
+
+TEST_F(StaticCacheTest, BudgetEvictsLeastRecentlyUsed)
+{
+    // HTTP_STATIC_CACHE_SIZE is 4096 for this test: two of these fit, three do not.
+    WriteFile("cache_1.js", 1500, '1', 1000);
+    WriteFile("cache_2.js", 1500, '2', 1000);
+    WriteFile("cache_3.js", 1500, '3', 1000);
+
+    StaticCacheRelease(StaticCacheLookup("cache_1.js", "application/javascript", NULL, NULL));
+    StaticCacheRelease(StaticCacheLookup("cache_2.js", "application/javascript", NULL, NULL));
+    StaticCacheEntry *e1 = StaticCacheLookup("cache_1.js", "application/javascript", NULL, NULL); // now most recent
+    StaticCacheRelease(e1);
+    size_t two = StaticCacheUsage();
+
+    StaticCacheRelease(StaticCacheLookup("cache_3.js", "application/javascript", NULL, NULL));
+    EXPECT_LE(StaticCacheUsage(), 4096u);
+    EXPECT_EQ(StaticCacheUsage(), two);
+    EXPECT_EQ(StaticCacheLookup("cache_1.js", "application/javascript", NULL, NULL), e1); // kept
+    StaticCacheRelease(e1);
+
+    remove("cache_1.js");
+    remove("cache_2.js");
+    remove("cache_3.js");
+}
+
+TEST_F(StaticCacheTest, SiblingsAreRechecked)
+{
+    static const char *const suffixes[] = { ".br", ".gz", NULL };
+    unsigned siblings = 0;
+    WriteFile("cache_s.js", 100, 's', 1000);
+    WriteFile("cache_s.js.gz", 50, 'z', 1000);
+
+    StaticCacheEntry *e1 = StaticCacheLookup("cache_s.js", "application/javascript", suffixes, &siblings);
+    ASSERT_NE(e1, (StaticCacheEntry *)NULL);
+    EXPECT_EQ(siblings, 2u);
+    StaticCacheRelease(e1);
+
+    // a hit trusts what it found for HTTP_STATIC_CACHE_RECHECK seconds
+    WriteFile("cache_s.js.br", 40, 'b', 1000);
+    e1 = StaticCacheLookup("cache_s.js", "application/javascript", suffixes, &siblings);
+    EXPECT_EQ(siblings, 2u);
+    StaticCacheRelease(e1);
+    EXPECT_EQ(StaticFileSiblings("cache_s.js", suffixes), 3u);
+
+    // then looks again, without reloading the file
+    sleep(HTTP_STATIC_CACHE_RECHECK);
+    StaticCacheEntry *e2 = StaticCacheLookup("cache_s.js", "application/javascript", suffixes, &siblings);
+    EXPECT_EQ(e1, e2);
+    EXPECT_EQ(siblings, 3u);
+    StaticCacheRelease(e2);
+
+    remove("cache_s.js.gz");
+    sleep(HTTP_STATIC_CACHE_RECHECK);
+    e2 = StaticCacheLookup("cache_s.js", "application/javascript", suffixes, &siblings);
+    EXPECT_EQ(siblings, 1u);
+    StaticCacheRelease(e2);
+    remove("cache_s.js");
+    remove("cache_s.js.br");
+}
+
+TEST_F(StaticCacheTest, LargeFileIsNotCached)
+{
+    WriteFile("cache_big.bin", 3000, 'x', 1000);
+    EXPECT_EQ(StaticCacheLookup("cache_big.bin", "text/plain", NULL, NULL), (StaticCacheEntry *)NULL);
+    EXPECT_EQ(StaticCacheUsage(), 0u);
+    remove("cache_big.bin");
+}
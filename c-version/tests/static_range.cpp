@@ -0,0 +1,218 @@
+#include <iostream>
+#include <string>
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+// The range helpers are static: test them where they live.
+#include "../lib/middleware.c"
+
+class StaticRangeTest : public ::testing::Test {
+protected:
+    // SetUp and TearDown executes for each test case.
+    void SetUp() override {
+        req = new HTTPReqMessage;
+        res = new HTTPRespMessage;
+        InitReqMessage(req);
+        InitRespMessage(res);
+        req->Header.Method = HTTP_GET;
+        req->KeepAlive = 1;
+        for (int i = 0; i < 100; i++)
+            body[i] = (uint8_t)('a' + i % 26);
+        memset(&f, 0, sizeof(f));
+        f.fd = -1;
+        f.mime_type = "text/plain";
+        f.length = 100;
+        f.mtime = 1000;
+        f.etag = "\"3e8-64\"";
+        f.data = body;
+    }
+
+    void TearDown() override {
+        if (res->BodyRelease)
+            res->BodyRelease(res->BodyContext);
+        delete req;
+        delete res;
+    }
+
+    // Class members are accessible from test cases. Reinitiated before each test.
+    HTTPReqMessage *req;
+    HTTPRespMessage *res;
+    StaticFile f;
+    uint8_t body[100];
+    ByteRange ranges[HTTP_MAX_RANGES];
+
+    std::string Ranges(const char *value, long length = 100) {
+        int count = _ParseRange(value, length, ranges, HTTP_MAX_RANGES);
+        std::string s = std::to_string(count);
+        for (int i = 0; i < count; i++)
+            s += " " + std::to_string(ranges[i].start) + "-" + std::to_string(ranges[i].end);
+        return s;
+    }
+
+    void Send(const char *range, const char *if_range = NULL) {
+        req->Header.Known[HTTP_HDR_RANGE] = range;
+        req->Header.Known[HTTP_HDR_IF_RANGE] = if_range;
+        _SendStaticFile(req, res, &f);
+    }
+
+    std::string Header() {
+        return std::string((const char *)res->_buf, res->_index);
+    }
+
+    std::string Status() {
+        std::string header = Header();
+        return header.substr(0, header.find("\r\n"));
+    }
+
+    std::string Field(const char *name) {
+        std::string header = Header();
+        size_t p = header.find(std::string("\r\n") + name + ": ");
+        if (p == std::string::npos)
+            return "<none>";
+        p += strlen(name) + 4;
+        return header.substr(p, header.find("\r\n", p) - p);
+    }
+
+    std::string Body() {
+        std::string out;
+        uint8_t buf[7]; // small, so parts are split across calls
+        int n;
+        if (res->BodyData)
+            return std::string((const char *)res->BodyData, res->BodyDataLength);
+        while (res->BodyCB && ((n = res->BodyCB(res->BodyContext, buf, sizeof(buf))) > 0))
+            out.append((const char *)buf, n);
+        return out;
+    }
+
+    std::string Bytes(long start, long end) {
+        return std::string((const char *)body + start, end - start + 1);
+    }
+};
+
+///////////////////////////////////////////////////////////////
+//                  STATIC RANGE TESTS                       //
+///////////////////////////////////////////////////////////////
+TEST_F(StaticRangeTest, ParseRange)
+{
+    EXPECT_EQ("1 0-9", Ranges("bytes=0-9"));
+    EXPECT_EQ("1 90-99", Ranges("bytes=90-"));             // open-ended
+    EXPECT_EQ("1 90-99", Ranges("bytes=-10"));             // suffix
+    EXPECT_EQ("1 0-99", Ranges("bytes=-500"));             // suffix longer than the body
+    EXPECT_EQ("1 50-99", Ranges("bytes=50-1000"));         // end past the body
+    EXPECT_EQ("3 0-4 10-14 95-99", Ranges("BYTES=0-4, 10-14,-5"));
+    EXPECT_EQ("1 0-9", Ranges("bytes=100-200, 0-9"));      // the unsatisfiable one is dropped
+    EXPECT_EQ("0", Ranges("bytes=100-"));                  // unsatisfiable
+    EXPECT_EQ("0", Ranges("bytes=-0"));
+    EXPECT_EQ("0", Ranges("bytes=0-9", 0));
+}
+
+TEST_F(StaticRangeTest, ParseRangeMalformed)
+{
+    EXPECT_EQ("-1", Ranges("items=0-9"));
+    EXPECT_EQ("-1", Ranges("bytes="));
+    EXPECT_EQ("-1", Ranges("bytes=,"));
+    EXPECT_EQ("-1", Ranges("bytes=a-b"));
+    EXPECT_EQ("-1", Ranges("bytes=9-0"));
+    EXPECT_EQ("-1", Ranges("bytes=0-9;x"));
+    EXPECT_EQ("-1", Ranges("bytes=-"));
+    EXPECT_EQ("-1", Ranges("bytes=0-1,2-3,4-5,6-7,8-9,10-11,12-13,14-15,16-17")); // too many
+}
+
+TEST_F(StaticRangeTest, SingleRange)
+{
+    Send("bytes=10-19");
+    EXPECT_EQ("HTTP/1.1 206 Partial Content", Status());
+    EXPECT_EQ("text/plain", Field("Content-Type"));
+    EXPECT_EQ("bytes 10-19/100", Field("Content-Range"));
+    EXPECT_EQ("10", Field("Content-Length"));
+    EXPECT_EQ("\"3e8-64\"", Field("ETag"));
+    EXPECT_EQ(Bytes(10, 19), Body());
+}
+
+TEST_F(StaticRangeTest, SuffixRangeOfAStream)
+{
+    f.data = NULL;
+    f.fp = fmemopen(body, sizeof(body), "r");
+    ASSERT_NE(f.fp, (FILE *)NULL);
+    Send("bytes=-15");
+    EXPECT_EQ("HTTP/1.1 206 Partial Content", Status());
+    EXPECT_EQ("bytes 85-99/100", Field("Content-Range"));
+    EXPECT_EQ(Bytes(85, 99), Body());
+}
+
+TEST_F(StaticRangeTest, MultipleRanges)
+{
+    Send("bytes=0-4,90-");
+    EXPECT_EQ("HTTP/1.1 206 Partial Content", Status());
+    std::string type = Field("Content-Type");
+    ASSERT_EQ(0u, type.find("multipart/byteranges; boundary="));
+    std::string boundary = type.substr(strlen("multipart/byteranges; boundary="));
+    EXPECT_EQ("<none>", Field("Content-Range"));
+
+    std::string expected = "--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-4/100\r\n\r\n" +
+        Bytes(0, 4) + "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 90-99/100\r\n\r\n" +
+        Bytes(90, 99) + "\r\n--" + boundary + "--\r\n";
+    std::string got = Body();
+    EXPECT_EQ(expected, got);
+    EXPECT_EQ(std::to_string(got.size()), Field("Content-Length"));
+}
+
+TEST_F(StaticRangeTest, Unsatisfiable)
+{
+    Send("bytes=200-300");
+    EXPECT_EQ("HTTP/1.1 416 Range Not Satisfiable", Status());
+    EXPECT_EQ("bytes */100", Field("Content-Range"));
+    EXPECT_EQ("0", Field("Content-Length"));
+    EXPECT_EQ(nullptr, res->BodyData);
+}
+
+TEST_F(StaticRangeTest, MalformedRangeSendsTheWholeFile)
+{
+    Send("bytes=oops");
+    EXPECT_EQ("HTTP/1.1 200 OK", Status());
+    EXPECT_EQ("100", Field("Content-Length"));
+    EXPECT_EQ(Bytes(0, 99), Body());
+}
+
+TEST_F(StaticRangeTest, IfRange)
+{
+    Send("bytes=0-9", "\"3e8-64\"");
+    EXPECT_EQ("HTTP/1.1 206 Partial Content", Status());
+    EXPECT_EQ(Bytes(0, 9), Body());
+
+    InitRespMessage(res);
+    Send("bytes=0-9", "Thu, 01 Jan 1970 00:16:40 GMT"); // == mtime
+    EXPECT_EQ("HTTP/1.1 206 Partial Content", Status());
+}
+
+TEST_F(StaticRangeTest, IfRangeMismatch)
+{
+    Send("bytes=0-9", "\"3e8-65\"");
+    EXPECT_EQ("HTTP/1.1 200 OK", Status());
+    EXPECT_EQ(Bytes(0, 99), Body());
+
+    InitRespMessage(res);
+    Send("bytes=0-9", "W/\"3e8-64\""); // weak tags never match
+    EXPECT_EQ("HTTP/1.1 200 OK", Status());
+
+    InitRespMessage(res);
+    Send("bytes=0-9", "Thu, 01 Jan 1970 00:16:41 GMT");
+    EXPECT_EQ("HTTP/1.1 200 OK", Status());
+}
+
+TEST_F(StaticRangeTest, NotModifiedKeepsVary)
+{
+    f.vary = 1;
+    f.encoding = "gzip";
+    Send(NULL);
+    EXPECT_EQ("HTTP/1.1 200 OK", Status());
+    EXPECT_EQ("gzip", Field("Content-Encoding"));
+    EXPECT_EQ("Accept-Encoding", Field("Vary"));
+
+    InitRespMessage(res);
+    req->Header.Known[HTTP_HDR_IF_NONE_MATCH] = "\"3e8-64\"";
+    Send(NULL);
+    EXPECT_EQ("HTTP/1.1 304 Not Modified", Status());
+    EXPECT_EQ("<none>", Field("Content-Encoding"));
+    EXPECT_EQ("Accept-Encoding", Field("Vary"));
+}